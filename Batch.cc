@@ -0,0 +1,274 @@
+/*
+ * cisc0
+ * Copyright (c) 2013-2018, Joshua Scoggins and Contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Core.h"
+#include "Channel.h"
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+void usage(const std::string& name) {
+	std::cerr << name << ": [-e standard|threaded|tiered] [-j workers] manifest" << std::endl;
+	std::cerr << "each line of the manifest is: image [input|-] [console-output|-] [output-image]" << std::endl;
+}
+using ExecutionEngine = cisc0::Core::ExecutionEngine;
+/**
+ * A single run of an image described by one line of the manifest
+ */
+struct Job {
+	std::string _image;
+	std::string _input;
+	std::string _console;
+	std::string _dump;
+	bool _succeeded = false;
+	std::string _problem;
+	uint64_t _instructions = 0;
+};
+/**
+ * An installed image which has not run yet, every job for that image is a
+ * fork of it so the image is only ever installed once.
+ */
+struct Prototype {
+	std::mutex _lock;
+	std::unique_ptr<cisc0::Core> _core;
+	std::string _problem;
+};
+/**
+ * Runs a fixed set of tasks on a group of threads. Each worker has its own
+ * queue and takes from the back of it, once it runs dry it steals from the
+ * front of the other queues.
+ */
+class WorkStealingPool {
+	public:
+		WorkStealingPool(size_t workers) : _queues(workers) { }
+		void run(size_t taskCount, std::function<void(size_t)> fn) {
+			for (size_t i = 0; i < taskCount; ++i) {
+				_queues[i % _queues.size()]._tasks.emplace_back(i);
+			}
+			std::vector<std::thread> threads;
+			for (size_t worker = 0; worker < _queues.size(); ++worker) {
+				threads.emplace_back([this, worker, &fn]() {
+					size_t task = 0;
+					while (take(worker, task)) {
+						fn(task);
+					}
+				});
+			}
+			for (auto& thread : threads) {
+				thread.join();
+			}
+		}
+	private:
+		bool take(size_t worker, size_t& task) {
+			{
+				auto& own = _queues[worker];
+				std::lock_guard<std::mutex> guard(own._lock);
+				if (!own._tasks.empty()) {
+					task = own._tasks.back();
+					own._tasks.pop_back();
+					return true;
+				}
+			}
+			for (size_t offset = 1; offset < _queues.size(); ++offset) {
+				auto& victim = _queues[(worker + offset) % _queues.size()];
+				std::lock_guard<std::mutex> guard(victim._lock);
+				if (!victim._tasks.empty()) {
+					task = victim._tasks.front();
+					victim._tasks.pop_front();
+					return true;
+				}
+			}
+			// nothing is ever added once running so everything is done
+			return false;
+		}
+	private:
+		struct Queue {
+			std::mutex _lock;
+			std::deque<size_t> _tasks;
+		};
+		std::vector<Queue> _queues;
+};
+std::string optionalField(std::istream& in) {
+	std::string value;
+	if (in >> value && value != "-") {
+		return value;
+	}
+	return "";
+}
+void runJob(Job& job, Prototype& prototype) {
+	if (!prototype._core) {
+		job._problem = prototype._problem;
+		return;
+	}
+	std::unique_ptr<cisc0::Core> core;
+	{
+		std::lock_guard<std::mutex> guard(prototype._lock);
+		core = prototype._core->fork();
+	}
+	try {
+		if (!job._input.empty()) {
+			core->setInput(cisc0::DescriptorInput::open(job._input));
+		} else {
+			core->setInput(std::make_shared<cisc0::MemoryInput>(""));
+		}
+		if (!job._console.empty()) {
+			core->setOutput(cisc0::DescriptorOutput::open(job._console));
+		} else {
+			core->setOutput(std::make_shared<cisc0::DiscardOutput>());
+		}
+		core->run();
+	} catch (cisc0::Problem& p) {
+		job._problem = p.what();
+	}
+	job._instructions = core->getStatistics().getInstructionCount();
+	if (!job._problem.empty()) {
+		return;
+	}
+	if (!job._dump.empty()) {
+		std::ofstream file(job._dump.c_str(), std::ios::binary);
+		if (!file.is_open()) {
+			job._problem = "could not open " + job._dump + " for writing!";
+			return;
+		}
+		core->dump(file);
+	}
+	job._succeeded = true;
+}
+int main(int argc, char** argv) {
+	auto engine = ExecutionEngine::Standard;
+	size_t workers = std::thread::hardware_concurrency();
+	std::string manifest;
+	for (int i = 1; i < argc; ++i) {
+		std::string value = argv[i];
+		if (value == "-e" && i + 1 < argc) {
+			std::string name = argv[++i];
+			if (name == "standard") {
+				engine = ExecutionEngine::Standard;
+			} else if (name == "threaded") {
+				engine = ExecutionEngine::Threaded;
+			} else if (name == "tiered") {
+				engine = ExecutionEngine::Tiered;
+			} else {
+				std::cerr << "Unknown execution engine: " << name << std::endl;
+				usage(argv[0]);
+				return 1;
+			}
+		} else if (value == "-j" && i + 1 < argc) {
+			std::string count = argv[++i];
+			try {
+				workers = std::stoul(count, nullptr, 0);
+			} catch (std::exception&) {
+				std::cerr << "Expected a number after -j, got: " << count << std::endl;
+				usage(argv[0]);
+				return 1;
+			}
+		} else if (manifest.empty()) {
+			manifest = value;
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (manifest.empty()) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (workers == 0) {
+		workers = 1;
+	}
+	std::ifstream list(manifest.c_str());
+	if (!list.is_open()) {
+		std::cerr << "Could not open: " << manifest << " for reading!" << std::endl;
+		return 1;
+	}
+	std::vector<Job> jobs;
+	for (std::string line; std::getline(list, line); ) {
+		std::istringstream fields(line);
+		Job job;
+		if (!(fields >> job._image) || job._image[0] == '#') {
+			continue;
+		}
+		job._input = optionalField(fields);
+		job._console = optionalField(fields);
+		job._dump = optionalField(fields);
+		jobs.emplace_back(job);
+	}
+	// install each distinct image once up front
+	std::map<std::string, Prototype> prototypes;
+	for (auto& job : jobs) {
+		auto& prototype = prototypes[job._image];
+		if (prototype._core || !prototype._problem.empty()) {
+			continue;
+		}
+		std::ifstream input(job._image.c_str(), std::ios::binary);
+		if (!input.is_open()) {
+			prototype._problem = "could not open " + job._image + " for reading!";
+			continue;
+		}
+		try {
+			auto core = std::make_unique<cisc0::Core>(cisc0::readRegisterValue(input));
+			input.close();
+			core->setExecutionEngine(engine);
+			core->install(job._image);
+			prototype._core = std::move(core);
+		} catch (cisc0::Problem& p) {
+			prototype._problem = p.what();
+		}
+	}
+	auto start = std::chrono::steady_clock::now();
+	WorkStealingPool pool(workers);
+	pool.run(jobs.size(), [&jobs, &prototypes](size_t index) {
+		auto& job = jobs[index];
+		runJob(job, prototypes.find(job._image)->second);
+	});
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	int exitCode = 0;
+	uint64_t instructions = 0;
+	for (size_t i = 0; i < jobs.size(); ++i) {
+		auto& job = jobs[i];
+		instructions += job._instructions;
+		std::cout << i << " " << job._image << " ";
+		if (job._succeeded) {
+			std::cout << "ok " << job._instructions << std::endl;
+		} else {
+			std::cout << "problem: " << job._problem << std::endl;
+			exitCode = 1;
+		}
+	}
+	std::cerr << jobs.size() << " runs on " << workers << " workers, " << instructions << " instructions in " << elapsed.count() << "s";
+	if (elapsed.count() > 0) {
+		std::cerr << " (" << (double(instructions) / elapsed.count() / 1.0e6) << " MIPS)";
+	}
+	std::cerr << std::endl;
+	return exitCode;
+}
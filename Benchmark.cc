@@ -0,0 +1,295 @@
+/*
+ * cisc0
+ * Copyright (c) 2013-2018, Joshua Scoggins and Contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Core.h"
+#include "Channel.h"
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+using byte = cisc0::byte;
+using Address = cisc0::Address;
+using MemoryWord = cisc0::MemoryWord;
+using Core = cisc0::Core;
+using OperationKind = Core::OperationKind;
+using ExecutionEngine = Core::ExecutionEngine;
+
+struct Result {
+	std::string _name;
+	uint64_t _iterations;
+	double _nanosecondsPerOperation;
+};
+/**
+ * Throws away everything written to it while still going through the
+ * stream machinery
+ */
+class DiscardBuffer : public std::streambuf {
+	protected:
+		int_type overflow(int_type ch) override { return traits_type::not_eof(ch); }
+		std::streamsize xsputn(const char*, std::streamsize count) override { return count; }
+};
+/// keep the optimizer from throwing away the work being timed
+template<typename T>
+void keep(const T& value) {
+	asm volatile("" : : "g"(&value) : "memory");
+}
+/**
+ * Run fn in batches which keep doubling until a batch takes long enough
+ * to be worth measuring
+ */
+template<typename F>
+Result measure(const std::string& name, F fn) {
+	using Clock = std::chrono::steady_clock;
+	constexpr double minimumSeconds = 0.1;
+	for (uint64_t iterations = 1; ; iterations *= 2) {
+		auto start = Clock::now();
+		for (uint64_t i = 0; i < iterations; ++i) {
+			fn();
+		}
+		std::chrono::duration<double> elapsed = Clock::now() - start;
+		if (elapsed.count() >= minimumSeconds || iterations >= (uint64_t(1) << 32)) {
+			return { name, iterations, elapsed.count() * 1.0e9 / double(iterations) };
+		}
+	}
+}
+namespace cisc0 {
+/**
+ * Timing of the internals of Core, a friend so the private paths can be
+ * measured in isolation
+ */
+class CoreBenchmark {
+	public:
+		static constexpr Address capacity = 0x10000;
+		static constexpr Address programStart = 0x800;
+		CoreBenchmark() : _noOutput(&_discard) { }
+		void run(std::vector<Result>& results);
+		/// guest instructions per second of a tight loop under each engine
+		void runGuest(std::vector<std::pair<std::string, double>>& mips);
+	private:
+		std::unique_ptr<Core> makeCore(Address cap = capacity);
+		/// first word decoding to the given kind, preferring r1 and r2 as operands
+		static MemoryWord sampleWord(OperationKind kind);
+		void decodes(std::vector<Result>& results);
+		void invokes(std::vector<Result>& results);
+		void memory(std::vector<Result>& results);
+		void strings(std::vector<Result>& results);
+		void images(std::vector<Result>& results);
+	private:
+		DiscardBuffer _discard;
+		std::ostream _noOutput;
+};
+std::unique_ptr<Core> CoreBenchmark::makeCore(Address cap) {
+	auto core = std::make_unique<Core>(cap);
+	core->setInput(std::make_shared<MemoryInput>(""));
+	core->setOutput(std::make_shared<DiscardOutput>());
+	for (int i = 0; i < Core::ArchitectureConstants::RegisterCount; ++i) {
+		// keep divisors away from zero
+		core->getRegister(i).setAddress(i + 1);
+	}
+	core->getPC().setAddress(programStart);
+	return core;
+}
+MemoryWord CoreBenchmark::sampleWord(OperationKind kind) {
+	MemoryWord fallback = 0;
+	bool found = false;
+	for (Address word = 0; word < 0x10000; ++word) {
+		if (Core::Instruction::fromFirstWord(MemoryWord(word)).getKind() != kind) {
+			continue;
+		}
+		if ((word >> 8) == 0x12) {
+			return MemoryWord(word);
+		} else if (!found) {
+			fallback = MemoryWord(word);
+			found = true;
+		}
+	}
+	return fallback;
+}
+void CoreBenchmark::decodes(std::vector<Result>& results) {
+	auto core = makeCore();
+	for (byte k = 0; k < byte(OperationKind::IllegalOpcode); ++k) {
+		auto first = sampleWord(OperationKind(k));
+		core->storeWord(programStart, first);
+		core->storeWord(programStart - 1, 1);
+		core->storeWord(programStart - 2, 1);
+		auto pc = core->getPC();
+		results.emplace_back(measure(std::string("decode/") + Core::getKindName(OperationKind(k)), [&core, &pc]() {
+			pc.setAddress(programStart);
+			auto instruction = core->decode();
+			keep(instruction);
+		}));
+	}
+}
+void CoreBenchmark::invokes(std::vector<Result>& results) {
+	for (byte k = 0; k < byte(OperationKind::IllegalOpcode); ++k) {
+		auto core = makeCore();
+		auto instruction = Core::Instruction::fromFirstWord(sampleWord(OperationKind(k)));
+		instruction.setExtensionWords(1, 1);
+		results.emplace_back(measure(std::string("invoke/") + Core::getKindName(OperationKind(k)), [&core, &instruction]() {
+			core->execute(instruction);
+		}));
+	}
+}
+void CoreBenchmark::memory(std::vector<Result>& results) {
+	auto core = makeCore();
+	auto pc = core->getPC();
+	results.emplace_back(measure("nextWord", [&core, &pc]() {
+		pc.setAddress(programStart);
+		keep(core->nextWord());
+	}));
+	Address addr = 0;
+	results.emplace_back(measure("loadWord", [&core, &addr]() {
+		keep(core->loadWord(addr));
+		addr = (addr + 1) & (capacity - 1);
+	}));
+	results.emplace_back(measure("storeWord", [&core, &addr]() {
+		core->storeWord(addr, MemoryWord(addr));
+		addr = (addr + 1) & (capacity - 1);
+	}));
+	results.emplace_back(measure("pushParameterAddress", [&core]() {
+		core->pushParameterAddress(0xFDFDFDFD);
+	}));
+	results.emplace_back(measure("popSubroutineAddress", [&core]() {
+		keep(core->popSubroutineAddress());
+	}));
+}
+void CoreBenchmark::strings(std::vector<Result>& results) {
+	auto core = makeCore();
+	std::string text(64, 'x');
+	constexpr Address base = 0x4000;
+	results.emplace_back(measure("storeString/64", [&core, &text]() {
+		core->storeString(base, Address(text.size()), text);
+	}));
+	// loadString expects a 32-bit length in front of the characters
+	core->storeAddress(base - 2, Address(text.size()));
+	results.emplace_back(measure("loadString/64", [&core]() {
+		auto value = core->loadString(base - 2);
+		keep(value);
+	}));
+	constexpr Address copy = 0x8000;
+	results.emplace_back(measure("copyString/64", [&core]() {
+		core->copyString(copy, base - 2);
+	}));
+	results.emplace_back(measure("compareStrings/64", [&core]() {
+		keep(core->compareStrings(copy, base - 2));
+	}));
+}
+void CoreBenchmark::images(std::vector<Result>& results) {
+	auto core = makeCore(Core::defaultMemoryCapacity);
+	for (Address a = 0; a < Core::defaultMemoryCapacity; a += 0x101) {
+		core->storeWord(a, MemoryWord(a));
+	}
+	char path[] = "/tmp/benchcisc0.XXXXXX";
+	auto fd = mkstemp(path);
+	if (fd == -1) {
+		return;
+	}
+	close(fd);
+	{
+		std::ofstream file(path, std::ios::binary);
+		core->dump(file);
+	}
+	results.emplace_back(measure("dump/default", [&core, this]() {
+		core->dump(_noOutput);
+	}));
+	results.emplace_back(measure("install/default/mapped", [&core, &path]() {
+		core->install(std::string(path));
+	}));
+	results.emplace_back(measure("install/default/stream", [&core, &path]() {
+		std::ifstream file(path, std::ios::binary);
+		cisc0::readRegisterValue(file);
+		core->install(file);
+	}));
+	unlink(path);
+}
+void CoreBenchmark::run(std::vector<Result>& results) {
+	decodes(results);
+	invokes(results);
+	memory(results);
+	strings(results);
+	images(results);
+}
+void CoreBenchmark::runGuest(std::vector<std::pair<std::string, double>>& mips) {
+	constexpr Address iterations = 2000000;
+	constexpr MemoryWord fullMask = 0b1111 << 8;
+	constexpr MemoryWord immediate = 0b1'0000;
+	const std::pair<const char*, ExecutionEngine> engines[] = {
+		{ "standard", ExecutionEngine::Standard },
+		{ "threaded", ExecutionEngine::Threaded },
+		{ "tiered", ExecutionEngine::Tiered },
+	};
+	for (auto& engine : engines) {
+		auto core = makeCore();
+		core->setExecutionEngine(engine.second);
+		core->getRegister(0).setAddress(0);
+		// r0 += 1; r0 < iterations ? loop : terminate
+		std::vector<MemoryWord> program = {
+			MemoryWord(byte(Core::OperationCode::Arithmetic) | immediate | fullMask), 1, 0,
+			MemoryWord(byte(Core::OperationCode::Compare) | immediate | (byte(Core::CompareStyle::LessThan) << 5) | fullMask),
+			MemoryWord(iterations & 0xFFFF), MemoryWord(iterations >> 16),
+			// conditional branch, the upper half of the target comes first
+			MemoryWord(byte(Core::OperationCode::Branch) | immediate | 0b100'0000), 0, MemoryWord(programStart),
+			MemoryWord(byte(Core::OperationCode::Misc) | (byte(Core::MiscStyle::Terminate) << 4)),
+		};
+		auto addr = programStart;
+		for (auto word : program) {
+			core->storeWord(addr--, word);
+		}
+		auto start = std::chrono::steady_clock::now();
+		core->run();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		mips.emplace_back(engine.first, double(core->getStatistics().getInstructionCount()) / elapsed.count() / 1.0e6);
+	}
+}
+} // end namespace cisc0
+int main() {
+	cisc0::CoreBenchmark bench;
+	std::vector<Result> results;
+	std::vector<std::pair<std::string, double>> mips;
+	bench.run(results);
+	bench.runGuest(mips);
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << "{" << std::endl;
+	std::cout << "\t\"benchmarks\": [" << std::endl;
+	for (size_t i = 0; i < results.size(); ++i) {
+		auto& result = results[i];
+		std::cout << "\t\t{ \"name\": \"" << result._name << "\", \"iterations\": " << result._iterations << ", \"ns_per_op\": " << result._nanosecondsPerOperation << " }";
+		std::cout << (i + 1 < results.size() ? "," : "") << std::endl;
+	}
+	std::cout << "\t]," << std::endl;
+	std::cout << "\t\"guest_mips\": {" << std::endl;
+	for (size_t i = 0; i < mips.size(); ++i) {
+		std::cout << "\t\t\"" << mips[i].first << "\": " << mips[i].second << (i + 1 < mips.size() ? "," : "") << std::endl;
+	}
+	std::cout << "\t}" << std::endl;
+	std::cout << "}" << std::endl;
+	return 0;
+}
@@ -0,0 +1,192 @@
+/**
+ * @file
+ * buffered console channels for a core
+ * @copyright
+ * cisc0
+ * Copyright (c) 2013-2018, Joshua Scoggins and Contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "Channel.h"
+#include "Problem.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace cisc0 {
+	bool InputChannel::nextChunk() {
+		if (_finished) {
+			return false;
+		}
+		// an endpoint may hand back an empty chunk without being done
+		while (_cursor == _end) {
+			if (!refill()) {
+				_finished = true;
+				return false;
+			}
+		}
+		return true;
+	}
+	std::string InputChannel::getWord() {
+		int c = get();
+		while (c != endOfInput && std::isspace(c)) {
+			c = get();
+		}
+		std::string word;
+		while (c != endOfInput && !std::isspace(c)) {
+			word += char(c);
+			c = get();
+		}
+		// the whitespace which ended the word stays in the input just like
+		// with >>, get just handed it out of the current chunk so stepping
+		// back over it is always possible
+		if (c != endOfInput) {
+			--_cursor;
+		}
+		return word;
+	}
+	size_t InputChannel::read(char* out, size_t length) {
+		if (length == 0 || (_cursor == _end && !nextChunk())) {
+			return 0;
+		}
+		auto count = std::min(length, size_t(_end - _cursor));
+		std::memcpy(out, _cursor, count);
+		_cursor += count;
+		return count;
+	}
+	std::shared_ptr<InputChannel> InputChannel::standardInput() {
+		static auto channel = std::make_shared<DescriptorInput>(STDIN_FILENO);
+		return channel;
+	}
+
+	OutputChannel::OutputChannel(size_t bufferSize) : _buffer(std::make_unique<char[]>(bufferSize)), _cursor(_buffer.get()), _end(_buffer.get() + bufferSize) { }
+	void OutputChannel::write(const char* data, size_t length) {
+		if (length >= size_t(_end - _buffer.get())) {
+			flush();
+			drain(data, length);
+			return;
+		}
+		if (length > size_t(_end - _cursor)) {
+			flush();
+		}
+		std::memcpy(_cursor, data, length);
+		_cursor += length;
+	}
+	std::shared_ptr<OutputChannel> OutputChannel::standardOutput() {
+		static auto channel = std::make_shared<DescriptorOutput>(STDOUT_FILENO);
+		return channel;
+	}
+
+	MemoryInput::MemoryInput(std::string contents) : _contents(std::move(contents)) {
+		_cursor = _contents.data();
+		_end = _contents.data() + _contents.size();
+	}
+
+	DescriptorInput::DescriptorInput(int fd, bool owned) : _fd(fd), _owned(owned), _buffer(std::make_unique<char[]>(bufferSize)) { }
+	DescriptorInput::~DescriptorInput() {
+		if (_owned) {
+			::close(_fd);
+		}
+	}
+	std::shared_ptr<DescriptorInput> DescriptorInput::open(const std::string& path) {
+		auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			throw Problem("could not open " + path + " for reading: " + std::strerror(errno));
+		}
+		return std::make_shared<DescriptorInput>(fd, true);
+	}
+	bool DescriptorInput::refill() {
+		while (true) {
+			auto count = ::read(_fd, _buffer.get(), bufferSize);
+			if (count > 0) {
+				_cursor = _buffer.get();
+				_end = _buffer.get() + count;
+				return true;
+			} else if (count == 0) {
+				return false;
+			} else if (errno != EINTR) {
+				throw Problem(std::string("could not read console input: ") + std::strerror(errno));
+			}
+		}
+	}
+
+	DescriptorOutput::DescriptorOutput(int fd, bool owned) : _fd(fd), _owned(owned) { }
+	DescriptorOutput::~DescriptorOutput() {
+		try {
+			flush();
+		} catch (Problem&) {
+			// nowhere left to report it
+		}
+		if (_owned) {
+			::close(_fd);
+		}
+	}
+	std::shared_ptr<DescriptorOutput> DescriptorOutput::open(const std::string& path) {
+		auto fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+		if (fd < 0) {
+			throw Problem("could not open " + path + " for writing: " + std::strerror(errno));
+		}
+		return std::make_shared<DescriptorOutput>(fd, true);
+	}
+	void DescriptorOutput::drain(const char* data, size_t length) {
+		while (length > 0) {
+			auto count = ::write(_fd, data, length);
+			if (count >= 0) {
+				data += count;
+				length -= size_t(count);
+			} else if (errno != EINTR) {
+				throw Problem(std::string("could not write console output: ") + std::strerror(errno));
+			}
+		}
+	}
+
+	std::pair<std::shared_ptr<DescriptorInput>, std::shared_ptr<DescriptorOutput>> makePipe() {
+		int fds[2];
+		if (::pipe(fds) != 0) {
+			throw Problem(std::string("could not make a pipe: ") + std::strerror(errno));
+		}
+		return { std::make_shared<DescriptorInput>(fds[0], true), std::make_shared<DescriptorOutput>(fds[1], true) };
+	}
+
+	bool StreamInput::refill() {
+		// wait for one character then take whatever else is ready so an
+		// interactive stream is never asked for more than it has
+		if (!_in.read(_buffer.get(), 1)) {
+			return false;
+		}
+		auto count = 1 + _in.readsome(_buffer.get() + 1, bufferSize - 1);
+		_cursor = _buffer.get();
+		_end = _buffer.get() + count;
+		return true;
+	}
+	StreamOutput::~StreamOutput() {
+		flush();
+	}
+	void StreamOutput::drain(const char* data, size_t length) {
+		_out.write(data, std::streamsize(length));
+	}
+} // end namespace cisc0
@@ -0,0 +1,206 @@
+/**
+ * @file
+ * buffered console channels for a core
+ * @copyright
+ * cisc0
+ * Copyright (c) 2013-2018, Joshua Scoggins and Contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef _CISC0_CHANNEL_H
+#define _CISC0_CHANNEL_H
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <utility>
+
+namespace cisc0 {
+	/**
+	 * Where a core's console input comes from. Characters are handed out
+	 * of a buffer without any virtual calls, endpoints only get involved
+	 * once the buffer runs dry.
+	 */
+	class InputChannel {
+		public:
+			static constexpr int endOfInput = -1;
+			virtual ~InputChannel() = default;
+			/// @return the next character as an unsigned char or endOfInput
+			int get() {
+				if (_cursor == _end && !nextChunk()) {
+					return endOfInput;
+				}
+				return static_cast<unsigned char>(*_cursor++);
+			}
+			/**
+			 * Skip leading whitespace and read up to the next whitespace,
+			 * just like extracting a std::string from a stream
+			 * @return an empty string if the input ran out first
+			 */
+			std::string getWord();
+			/**
+			 * Copy up to length characters out, the endpoint is only asked
+			 * for more if nothing is buffered
+			 * @return how many were copied, zero once the input runs out
+			 */
+			size_t read(char* out, size_t length);
+			/// true if a character can be handed out without touching the endpoint
+			bool buffered() const noexcept { return _cursor != _end; }
+			/// the process wide channel reading from standard input
+			static std::shared_ptr<InputChannel> standardInput();
+		protected:
+			/**
+			 * Point _cursor and _end at more input
+			 * @return false once there is no more input
+			 */
+			virtual bool refill() = 0;
+		private:
+			bool nextChunk();
+		protected:
+			const char* _cursor = nullptr;
+			const char* _end = nullptr;
+		private:
+			/// once the endpoint runs out it is not asked again
+			bool _finished = false;
+	};
+	/**
+	 * Where a core's console output goes. Characters are collected in a
+	 * large buffer and handed to the endpoint in batches, when the buffer
+	 * fills up, when flushed, and when the channel is destroyed.
+	 */
+	class OutputChannel {
+		public:
+			static constexpr size_t defaultBufferSize = 64 * 1024;
+			explicit OutputChannel(size_t bufferSize = defaultBufferSize);
+			/// endpoints have to flush in their own destructor since drain is virtual
+			virtual ~OutputChannel() = default;
+			void put(char c) {
+				if (_cursor == _end) {
+					flush();
+				}
+				*_cursor++ = c;
+			}
+			void flush() {
+				if (_cursor != _buffer.get()) {
+					drain(_buffer.get(), size_t(_cursor - _buffer.get()));
+					_cursor = _buffer.get();
+				}
+			}
+			/// anything at least as large as the buffer goes straight to the endpoint
+			void write(const char* data, size_t length);
+			/// the process wide channel writing to standard output
+			static std::shared_ptr<OutputChannel> standardOutput();
+		protected:
+			/// hand everything to the endpoint
+			virtual void drain(const char* data, size_t length) = 0;
+		private:
+			std::unique_ptr<char[]> _buffer;
+			char* _cursor;
+			char* _end;
+	};
+	/// input served straight out of a string, nothing is copied
+	class MemoryInput : public InputChannel {
+		public:
+			explicit MemoryInput(std::string contents);
+		protected:
+			bool refill() override { return false; }
+		private:
+			std::string _contents;
+	};
+	/// output collected into a string
+	class MemoryOutput : public OutputChannel {
+		public:
+			~MemoryOutput() override { flush(); }
+			const std::string& getContents() {
+				flush();
+				return _contents;
+			}
+		protected:
+			void drain(const char* data, size_t length) override { _contents.append(data, length); }
+		private:
+			std::string _contents;
+	};
+	/// output which is thrown away
+	class DiscardOutput : public OutputChannel {
+		public:
+			DiscardOutput() : OutputChannel(4096) { }
+		protected:
+			void drain(const char*, size_t) override { }
+	};
+	/// input read from a file descriptor, like a file, pipe, or terminal
+	class DescriptorInput : public InputChannel {
+		public:
+			static constexpr size_t bufferSize = 64 * 1024;
+			/// @param owned close the descriptor along with the channel
+			DescriptorInput(int fd, bool owned = false);
+			~DescriptorInput() override;
+			/// open the given file for reading, raises a Problem if it can't be
+			static std::shared_ptr<DescriptorInput> open(const std::string& path);
+		protected:
+			bool refill() override;
+		private:
+			int _fd;
+			bool _owned;
+			std::unique_ptr<char[]> _buffer;
+	};
+	/// output written to a file descriptor
+	class DescriptorOutput : public OutputChannel {
+		public:
+			DescriptorOutput(int fd, bool owned = false);
+			~DescriptorOutput() override;
+			/// create or truncate the given file, raises a Problem if it can't be
+			static std::shared_ptr<DescriptorOutput> open(const std::string& path);
+		protected:
+			void drain(const char* data, size_t length) override;
+		private:
+			int _fd;
+			bool _owned;
+	};
+	/**
+	 * Both ends of a host pipe, whatever is written to the output end
+	 * comes out of the input end. Useful for connecting one core's
+	 * console to another's, or to another thread, keeping in mind the
+	 * writer blocks once the host pipe is full.
+	 */
+	std::pair<std::shared_ptr<DescriptorInput>, std::shared_ptr<DescriptorOutput>> makePipe();
+	/// adapters for code which already has a stream
+	class StreamInput : public InputChannel {
+		public:
+			static constexpr size_t bufferSize = 4096;
+			explicit StreamInput(std::istream& in) : _in(in), _buffer(std::make_unique<char[]>(bufferSize)) { }
+		protected:
+			bool refill() override;
+		private:
+			std::istream& _in;
+			std::unique_ptr<char[]> _buffer;
+	};
+	class StreamOutput : public OutputChannel {
+		public:
+			explicit StreamOutput(std::ostream& out) : _out(out) { }
+			~StreamOutput() override;
+		protected:
+			void drain(const char* data, size_t length) override;
+		private:
+			std::ostream& _out;
+	};
+} // end namespace cisc0
+#endif // end _CISC0_CHANNEL_H
@@ -28,249 +28,601 @@
 
 
 #include "Core.h"
+#include "Channel.h"
+#include "InputLog.h"
+#include "Jit.h"
+#include "Profiler.h"
+#include "Trace.h"
 #include "Problem.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <fstream>
 #include <sstream>
+#include <mutex>
+#include <vector>
+#include <csetjmp>
+#include <csignal>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace cisc0 {
-	void Register::increment(Address incrementValue) noexcept {
-		_address += incrementValue;
-		maskContents();
+	/**
+	 * Every possible first word decoded ahead of time. Built at compile time
+	 * from Instruction::fromFirstWord so the two can never disagree.
+	 */
+	constexpr auto firstWordTable = ([]() {
+		std::array<Core::Instruction, 0x10000> table { };
+		for (Address i = 0; i < table.size(); ++i) {
+			table[i] = Core::Instruction::fromFirstWord(MemoryWord(i));
+		}
+		return table;
+	})();
+	static_assert(firstWordTable[0].getKind() == Core::OperationKind::MemoryLoad && firstWordTable[0xFFFF].getKind() == Core::OperationKind::IllegalOpcode, "first word table was built incorrectly!");
+	RegisterFile::RegisterFile() noexcept {
+		for (auto& value : _values) {
+			value = 0;
+		}
+		for (auto& mask : _masks) {
+			mask = 0xFFFFFFFF;
+		}
 	}
-	void Register::decrement(Address decrementValue) noexcept {
-		_address -= decrementValue;
-		maskContents();
+	void RegisterFile::setMask(RegisterIndex index, Address mask) noexcept {
+		_masks[index - firstMasked] = mask;
+		_values[index] &= mask;
+	}
+	PagedMemory::Page PagedMemory::zeroPage() noexcept {
+		// never written to, store swaps in a real page first
+		static MemoryWord zeroes[pageSize] = { 0 };
+		return zeroes;
+	}
+	PagedMemory::Region* PagedMemory::zeroRegion() noexcept {
+		static Region* region = []() {
+			static Region zeroes;
+			for (Address i = 0; i < pagesPerRegion; ++i) {
+				zeroes._read[i] = zeroPage();
+				zeroes._write[i] = nullptr;
+			}
+			return &zeroes;
+		}();
+		return region;
 	}
-	void Register::setMask(Address mask) noexcept {
-		_mask = mask;
-		maskContents();
+	PagedMemory::PagedMemory() noexcept {
+		for (auto& region : _regions) {
+			region = zeroRegion();
+		}
 	}
-	void Register::maskContents() noexcept {
-		_address = _address & _mask;
+	PagedMemory::~PagedMemory() {
+		release();
 	}
-	void Register::setAddress(Address a) noexcept {
-		_address = a;
-		maskContents();
+	PagedMemory::Region& PagedMemory::writableRegion(Address addr) {
+		auto index = addr >> regionShift;
+		if (!_ownedRegions[index]) {
+			_ownedRegions[index] = std::make_unique<Region>(*zeroRegion());
+			_regions[index] = _ownedRegions[index].get();
+		}
+		return *_ownedRegions[index];
+	}
+	PagedMemory::Page PagedMemory::makeWritable(Address addr) {
+		auto& region = writableRegion(addr);
+		auto index = pageIndex(addr);
+		auto& owner = region._owners[index];
+		if (!owner || owner.use_count() > 1) {
+			// untouched or still shared with a fork, take a private copy
+			std::shared_ptr<MemoryWord[]> page(new MemoryWord[pageSize]);
+			std::memcpy(page.get(), region._read[index], pageSize * sizeof(MemoryWord));
+			owner = page;
+			region._read[index] = page.get();
+		}
+		region._write[index] = owner.get();
+		return owner.get();
+	}
+	void PagedMemory::read(Address addr, MemoryWord* words, Address count) const noexcept {
+		for (Address done = 0; done < count; ) {
+			auto offset = (addr + done) & pageMask;
+			auto span = std::min(count - done, pageSize - offset);
+			std::memcpy(words + done, readablePage(addr + done) + offset, span * sizeof(MemoryWord));
+			done += span;
+		}
 	}
-	void Register::setInteger(Integer a) noexcept {
-		_integer = a;
-		maskContents();
+	void PagedMemory::write(Address addr, const MemoryWord* words, Address count) {
+		for (Address done = 0; done < count; ) {
+			auto offset = (addr + done) & pageMask;
+			auto span = std::min(count - done, pageSize - offset);
+			std::memcpy(writablePage(addr + done) + offset, words + done, span * sizeof(MemoryWord));
+			done += span;
+		}
 	}
-
-	Register& Core::getRegister(RegisterIndex idx) {
-		return _registers[idx & 0x0F];
+	void PagedMemory::move(Address to, Address from, Address count) {
+		// like memmove, go backward when moving up so nothing is read after being overwritten
+		auto backward = to > from;
+		MemoryWord chunk[pageSize];
+		for (Address done = 0; done < count; ) {
+			auto span = std::min(count - done, pageSize);
+			auto offset = backward ? count - done - span : done;
+			read(from + offset, chunk, span);
+			write(to + offset, chunk, span);
+			done += span;
+		}
 	}
-	Register& Core::getPC() {
-		return getRegister<Core::ArchitectureConstants::InstructionPointer>();
+	void PagedMemory::fill(Address addr, MemoryWord value, Address count) {
+		for (Address done = 0; done < count; ) {
+			auto offset = (addr + done) & pageMask;
+			auto span = std::min(count - done, pageSize - offset);
+			std::fill_n(writablePage(addr + done) + offset, span, value);
+			done += span;
+		}
 	}
-	Register& Core::getDestination(const Core::HasDestination& dest) {
-		return getRegister(dest.getDestination());
+	bool PagedMemory::equal(Address a, Address b, Address count) const noexcept {
+		for (Address done = 0; done < count; ) {
+			auto offsetA = (a + done) & pageMask;
+			auto offsetB = (b + done) & pageMask;
+			auto span = std::min({count - done, pageSize - offsetA, pageSize - offsetB});
+			if (std::memcmp(readablePage(a + done) + offsetA, readablePage(b + done) + offsetB, span * sizeof(MemoryWord)) != 0) {
+				return false;
+			}
+			done += span;
+		}
+		return true;
+	}
+	Address PagedMemory::find(Address addr, MemoryWord value, Address count) const noexcept {
+		for (Address done = 0; done < count; ) {
+			auto offset = (addr + done) & pageMask;
+			auto span = std::min(count - done, pageSize - offset);
+			auto page = readablePage(addr + done) + offset;
+			if (auto match = std::find(page, page + span, value); match != page + span) {
+				return done + Address(match - page);
+			}
+			done += span;
+		}
+		return count;
+	}
+	void PagedMemory::adopt(MemoryWord* words, Address count, void* mapping, size_t mappingLength) {
+		clear();
+		if (_flat) {
+			// the reservation has to stay put so the words are copied in
+			std::memcpy(_flat, words, size_t(count < _flatCount ? count : _flatCount) * sizeof(MemoryWord));
+			munmap(mapping, mappingLength);
+			return;
+		}
+		std::shared_ptr<void> file(mapping, [mappingLength](void* ptr) { munmap(ptr, mappingLength); });
+		auto whole = count & ~pageMask;
+		for (DoubleAddress base = 0; base < whole; base += pageSize) {
+			auto addr = Address(base);
+			auto& region = writableRegion(addr);
+			auto index = pageIndex(addr);
+			region._owners[index] = std::shared_ptr<MemoryWord[]>(file, words + addr);
+			region._read[index] = words + addr;
+			// the mapping is private so it is fine to write straight into it
+			region._write[index] = words + addr;
+		}
+		if (whole != count) {
+			// the mapping ends part way through the last page, anything
+			// reading or copying the whole page would run off the end
+			auto page = makeWritable(whole);
+			std::memcpy(page, words + whole, size_t(count - whole) * sizeof(MemoryWord));
+		}
 	}
-	Register& Core::getSource(const Core::HasSource& src) {
-		return getRegister(src.getSource());
+	void PagedMemory::fork(PagedMemory& other) {
+		release();
+		if (other._flat) {
+			// writes to a reservation skip copy on write so nothing can be
+			// shared, copy each page which is in use instead
+			other.forEachPage(other._flatCount, [this, &other](const MemoryWord* page, Address base) {
+				auto count = (other._flatCount - base) < pageSize ? (other._flatCount - base) : pageSize;
+				for (Address i = 0; i < count; ++i) {
+					if (page[i] != 0) {
+						std::memcpy(makeWritable(base), page, count * sizeof(MemoryWord));
+						return;
+					}
+				}
+			});
+			return;
+		}
+		for (Address i = 0; i < regionCount; ++i) {
+			if (auto& region = other._ownedRegions[i]; region) {
+				// neither side gets to write to a shared page without copying it
+				for (auto& page : region->_write) {
+					page = nullptr;
+				}
+				_ownedRegions[i] = std::make_unique<Region>(*region);
+				_regions[i] = _ownedRegions[i].get();
+			}
+		}
 	}
-	Core::Core(Address memCap) : _capacity(memCap) {
-		_memory = std::make_unique<MemoryWord[]>(memCap);
-		_registers = std::make_unique<Register[]>(16);
-		for ( int i = 0; i < 16; ++i) {
-			_registers[i] = 0;
+	void PagedMemory::clear() noexcept {
+		for (Address i = 0; i < regionCount; ++i) {
+			_regions[i] = zeroRegion();
+			_ownedRegions[i].reset();
 		}
-		for (Address a = 0; a < memCap; ++a) {
-			_memory[a] = 0;
+		if (_flat) {
+			// private anonymous memory reads back as zero once dropped
+			madvise(_reservation, _committedLength, MADV_DONTNEED);
+			mapReservation();
 		}
+	}
+	void PagedMemory::reserve(Address count) {
+		release();
+		auto hostPage = size_t(sysconf(_SC_PAGESIZE));
+		auto used = size_t(count) * sizeof(MemoryWord);
+		auto committed = (used + hostPage - 1) / hostPage * hostPage;
+		// the words are placed so the last one ends right where the first
+		// guard page starts, which takes some slack in front of them
+		auto length = committed + (DoubleAddress(1) << 32) * sizeof(MemoryWord);
+		auto mem = mmap(nullptr, length, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (mem == MAP_FAILED) {
+			throw Problem("Unable to reserve the guest address space!");
+		}
+		if (committed != 0 && mprotect(mem, committed, PROT_READ | PROT_WRITE) != 0) {
+			munmap(mem, length);
+			throw Problem("Unable to commit guest memory!");
+		}
+		_reservation = mem;
+		_reservationLength = length;
+		_committedLength = committed;
+		_flat = reinterpret_cast<MemoryWord*>(static_cast<byte*>(mem) + (committed - used));
+		_flatCount = count;
+		mapReservation();
+	}
+	void PagedMemory::release() noexcept {
+		auto reservation = _reservation;
+		auto length = _reservationLength;
+		_reservation = nullptr;
+		_reservationLength = 0;
+		_committedLength = 0;
+		_flat = nullptr;
+		_flatCount = 0;
+		clear();
+		if (reservation) {
+			munmap(reservation, length);
+		}
+	}
+	void PagedMemory::mapReservation() {
+		for (DoubleAddress base = 0; base < _flatCount; base += pageSize) {
+			auto addr = Address(base);
+			auto& region = writableRegion(addr);
+			auto index = pageIndex(addr);
+			region._owners[index].reset();
+			region._read[index] = _flat + addr;
+			region._write[index] = _flat + addr;
+		}
+	}
+	Core::Core(Address memCap) : _capacity(memCap), _input(InputChannel::standardInput()), _output(OutputChannel::standardOutput()) {
 		auto capacityMask = _capacity - 1;
-		getAddressRegister().setMask(capacityMask);
-		getPC().setMask(capacityMask);
-		_registers[Core::ArchitectureConstants::StackPointer].setMask(capacityMask);
-		_registers[Core::ArchitectureConstants::CallStackPointer].setMask(capacityMask);
+		_registers.setMask(ArchitectureConstants::AddressRegister, capacityMask);
+		_registers.setMask(ArchitectureConstants::InstructionPointer, capacityMask);
+		_registers.setMask(ArchitectureConstants::StackPointer, capacityMask);
+		_registers.setMask(ArchitectureConstants::CallStackPointer, capacityMask);
+		// the decode cache relies on the instruction pointer wrapping cleanly
+		// so only use it when the capacity is a power of two
+		if (_capacity != 0 && (_capacity & capacityMask) == 0) {
+			_decodeCache = std::make_unique<CachedInstruction[]>(decodeCacheSize);
+		}
 	}
+	Core::~Core() { }
+	void Core::setInput(std::shared_ptr<InputChannel> in) noexcept {
+		_input = std::move(in);
+	}
+	void Core::setOutput(std::shared_ptr<OutputChannel> out) noexcept {
+		_output = std::move(out);
+	}
+	void Core::attachDevice(byte page, std::shared_ptr<Device> device) {
+		_devices.attach(page, std::move(device));
+		// the upper byte picks the device so it can't be masked away
+		_registers.setMask(ArchitectureConstants::AddressRegister, 0xFFFFFFFF);
+		// native code has the old mask baked in
+		flushCompiledBlocks();
+	}
+	void Core::setInput(std::istream& in) {
+		_input = std::make_shared<StreamInput>(in);
+	}
+	void Core::setOutput(std::ostream& out) {
+		_output = std::make_shared<StreamOutput>(out);
+	}
+	std::unique_ptr<Core> Core::fork() {
+		auto child = std::make_unique<Core>(_capacity);
+		child->_registers = _registers;
+		// the child has no devices so the address register wraps at the capacity again
+		child->_registers.setMask(ArchitectureConstants::AddressRegister, _capacity - 1);
+		child->_conditionRegister = _conditionRegister;
+		child->_keepExecuting = _keepExecuting;
+		child->setExecutionEngine(_engine);
+		child->_memory.fork(_memory);
+		if (_decodeCache) {
+			// decodes stay valid since the memory is the same, native code
+			// belongs to this core's jit though
+			for (Address i = 0; i < decodeCacheSize; ++i) {
+				child->_decodeCache[i] = _decodeCache[i];
+				child->_decodeCache[i]._block = nullptr;
+			}
+		}
+		return child;
+	}
+	template<Address capacity>
 	MemoryWord Core::loadWord(Address addr) {
-		if (addr >= _capacity) {
+		if constexpr (capacity == guardedCapacity) {
+			// anything past the capacity faults
+			return _memory.getReservation()[addr];
+		}
+		if (addr >= (capacity == dynamicCapacity ? _capacity : capacity)) {
+			if (auto device = _devices.lookup(addr); device) {
+				return device->load(addr);
+			}
 			throw Problem("Illegal address!");
 		} else {
-			return _memory[addr];
+			return _memory.load(addr);
 		}
 	}
+	template<Address capacity>
 	void Core::storeWord(Address addr, MemoryWord value) {
-		if (addr >= _capacity) {
-			throw Problem("Illegal address!");
+		if constexpr (capacity == guardedCapacity) {
+			_memory.getReservation()[addr] = value;
+			if (_decodeCache) {
+				invalidateDecodeCache(addr);
+			}
+			if (_jit && _jit->covers(addr)) {
+				invalidateCompiledBlocks(addr);
+			}
+			return;
+		}
+		if (addr >= (capacity == dynamicCapacity ? _capacity : capacity)) {
+			auto device = _devices.lookup(addr);
+			if (!device) {
+				throw Problem("Illegal address!");
+			}
+			device->store(addr, value);
+			if (_trace) {
+				_trace->noteStore(addr, value);
+			}
 		} else {
-			_memory[addr] = value;
+			_memory.store(addr, value);
+			if (_trace) {
+				_trace->noteStore(addr, value);
+			}
+			if (_decodeCache) {
+				invalidateDecodeCache(addr);
+			}
+			if (_jit && _jit->covers(addr)) {
+				invalidateCompiledBlocks(addr);
+			}
 		}
 	}
+	template<Address capacity>
 	MemoryWord Core::nextWord() {
-		auto& pc = getPC();
-		MemoryWord curr = loadWord(pc.getAddress());
-		pc.increment(_capacity - 1);
+		auto addr = _registers.get(ArchitectureConstants::InstructionPointer);
+		MemoryWord curr = loadWord<capacity>(addr);
+		constexpr bool fixed = isFixedCapacity(capacity);
+		setPC<capacity>(addr + (fixed ? capacity : _capacity) - 1);
 		return curr;
 	}
+	template<Address capacity>
 	MemoryWord Core::popSubroutineWord() noexcept {
-		auto& subroutine = getRegister<Core::ArchitectureConstants::CallStackPointer>();
-		auto value = loadWord(subroutine.getAddress());
+		auto subroutine = getRegister<Core::ArchitectureConstants::CallStackPointer>();
+		auto value = loadWord<capacity>(subroutine.getAddress());
 		subroutine.increment();
 		return value;
 	}
+	template<Address capacity>
 	Address Core::popSubroutineAddress() noexcept {
-		auto lowerHalf = Address(popSubroutineWord());
-		auto upperHalf = Address(popSubroutineWord()) << 16;
+		auto lowerHalf = Address(popSubroutineWord<capacity>());
+		auto upperHalf = Address(popSubroutineWord<capacity>()) << 16;
 		return lowerHalf | upperHalf;
 	}
+	template<Address capacity>
 	MemoryWord Core::popParameterWord() noexcept {
-		auto& sp = getRegister<Core::ArchitectureConstants::StackPointer>();
-		auto value = loadWord(sp.getAddress());
+		auto sp = getRegister<Core::ArchitectureConstants::StackPointer>();
+		auto value = loadWord<capacity>(sp.getAddress());
 		sp.increment();
 		return value;
 	}
+	template<Address capacity>
 	Address Core::popParameterAddress() noexcept {
-		auto lower = Address(popParameterWord());
-		auto upper = Address(popParameterWord()) << 16;
+		auto lower = Address(popParameterWord<capacity>());
+		auto upper = Address(popParameterWord<capacity>()) << 16;
 		return lower | upper;
 	}
-	void Core::invoke(const Core::Return&) {
-		auto newAddr = popSubroutineAddress();
+	template<Address capacity>
+	void Core::invoke(OperationTag<OperationKind::IllegalOpcode>, const Instruction&) {
+		throw Problem("Illegal Opcode!");
+	}
+
+	template<Address capacity>
+	void Core::invoke(OperationTag<OperationKind::IllegalMisc>, const Instruction&) {
+		throw Problem("Undefined or unimplemented misc operation!");
+	}
+
+	template<Address capacity>
+	void Core::invoke(OperationTag<OperationKind::Return>, const Instruction&) {
+		auto newAddr = popSubroutineAddress<capacity>();
 		getPC().setAddress(newAddr);
 	}
 
-	void Core::invoke(const Core::Terminate&) {
+	template<Address capacity>
+	void Core::invoke(OperationTag<OperationKind::Terminate>, const Instruction&) {
 		_keepExecuting = false;
 	}
 
+    template<Address capacity>
+    void Core::invoke(OperationTag<OperationKind::StringCopy>, const Instruction& value) {
+        auto src = getSource(value);
+        auto dest = getDestination(value);
+        copyString(dest.getAddress(), src.getAddress());
+    }
 
-	void Core::invoke(const Core::Misc& value) {
-		variantInvoke(value);
-	}
+    template<Address capacity>
+    void Core::invoke(OperationTag<OperationKind::ReadBuffer>, const Instruction& value) {
+        auto dest = getDestination(value);
+        dest.setAddress(readBuffer(getSource(value).getAddress(), dest.getAddress()));
+    }
+
+    template<Address capacity>
+    void Core::invoke(OperationTag<OperationKind::WriteBuffer>, const Instruction& value) {
+        auto dest = getDestination(value);
+        dest.setAddress(writeBuffer(getSource(value).getAddress(), dest.getAddress()));
+    }
+
+    template<Address capacity>
+    void Core::invoke(OperationTag<OperationKind::BlockCopy>, const Instruction& value) {
+        copyBlock(getDestination(value).getAddress(), getSource(value).getAddress(), getValueRegister().getAddress());
+    }
 
-	void Core::invoke(const Core::Swap& value) {
+    template<Address capacity>
+    void Core::invoke(OperationTag<OperationKind::BlockFill>, const Instruction& value) {
+        fillBlock(getDestination(value).getAddress(), getSource(value).getLowerHalf(), getValueRegister().getAddress());
+    }
+
+    template<Address capacity>
+    void Core::invoke(OperationTag<OperationKind::BlockCompare>, const Instruction& value) {
+        _conditionRegister = compareBlock(getDestination(value).getAddress(), getSource(value).getAddress(), getValueRegister().getAddress());
+    }
+
+    template<Address capacity>
+    void Core::invoke(OperationTag<OperationKind::BlockSearch>, const Instruction& value) {
+        auto dest = getDestination(value);
+        auto count = getValueRegister().getAddress();
+        auto index = searchBlock(dest.getAddress(), getSource(value).getLowerHalf(), count);
+        _conditionRegister = index != count;
+        dest.setAddress(index);
+    }
+
+    template<Address capacity>
+    void Core::invoke(OperationTag<OperationKind::StringEquals>, const Instruction& value) {
+        auto src = getSource(value);
+        auto dest = getDestination(value);
+        _conditionRegister = compareStrings(src.getAddress(), dest.getAddress());
+    }
+
+    template<Address capacity>
+    void Core::invoke(OperationTag<OperationKind::PutCharacter>, const Instruction& value) {
+        _output->put(char(getDestination(value).getInteger()));
+    }
+
+    template<Address capacity>
+    void Core::invoke(OperationTag<OperationKind::GetCharacter>, const Instruction& value) {
+        auto dest = getDestination(value);
+        dest.setInteger(readCharacter());
+    }
+
+    template<Address capacity>
+    void Core::invoke(OperationTag<OperationKind::ReadWord>, const Instruction& value) {
+        auto src = getSource(value);
+        auto dest = getDestination(value);
+        auto str = readWord();
+        auto length = str.size();
+        auto size = src.getAddress();
+        auto cap = length > size ? size : length ;
+        storeString(dest.getAddress(), cap, str);
+    }
+
+	template<Address capacity>
+	void Core::invoke(OperationTag<OperationKind::Swap>, const Instruction& value) {
 		if (value.getDestination() == value.getSource()) {
 			return;
 		}
-		auto& a = getDestination(value);
-		auto& b = getSource(value);
+		auto a = getDestination(value);
+		auto b = getSource(value);
 		auto c = a.getAddress();
 		a.setAddress(b.getAddress());
 		b.setAddress(c);
 	}
 
-	void Core::invoke(const Core::Set& value) {
+	template<Address capacity>
+	void Core::invoke(OperationTag<OperationKind::Set>, const Instruction& value) {
 		getDestination(value).setAddress(value.getImmediate());
 	}
 
-	void Core::invoke(const Core::Move& value) {
+	template<Address capacity>
+	void Core::invoke(OperationTag<OperationKind::Move>, const Instruction& value) {
 		getDestination(value).setAddress(getSource(value).getAddress() & value.getExpandedBitmask());
 	}
 
-	void Core::invoke(const Core::Memory& value) {
-		variantInvoke(value);
-	}
-	void Register::setLowerHalf(MemoryWord value) noexcept {
-		auto addr = Address(value);
-		auto other = Address(getUpperHalf()) << 16;
-		setAddress(addr | other);
-	}
-	void Register::setUpperHalf(MemoryWord value) noexcept {
-		auto addr = Address(value) << 16;
-		auto other = Address(getLowerHalf());
-		setAddress(addr | other);
-	}
+	template<Address capacity>
 	void Core::pushParameterWord(MemoryWord w) noexcept {
-		auto& sp = getRegister<Core::ArchitectureConstants::StackPointer>();
+		auto sp = getRegister<Core::ArchitectureConstants::StackPointer>();
 		sp.decrement();
-		storeWord(sp.getAddress(), w);
+		storeWord<capacity>(sp.getAddress(), w);
 	}
+	template<Address capacity>
 	void Core::pushParameterAddress(Address a) noexcept {
-		pushParameterWord(MemoryWord((a & 0xFFFF0000) >> 16));
-		pushParameterWord(MemoryWord(a));
+		pushParameterWord<capacity>(MemoryWord((a & 0xFFFF0000) >> 16));
+		pushParameterWord<capacity>(MemoryWord(a));
 	}
+	template<Address capacity>
 	void Core::pushSubroutineWord(MemoryWord w) noexcept {
-		auto& sp = getRegister<Core::ArchitectureConstants::CallStackPointer>();
+		auto sp = getRegister<Core::ArchitectureConstants::CallStackPointer>();
 		sp.decrement();
-		storeWord(sp.getAddress(), w);
+		storeWord<capacity>(sp.getAddress(), w);
 	}
+	template<Address capacity>
 	void Core::pushSubroutineAddress(Address a) noexcept {
-		pushSubroutineWord(MemoryWord((a & 0xFFFF0000) >> 16));
-		pushSubroutineWord(MemoryWord(a));
+		pushSubroutineWord<capacity>(MemoryWord((a & 0xFFFF0000) >> 16));
+		pushSubroutineWord<capacity>(MemoryWord(a));
 	}
 
-	void Core::invoke(const Core::MemoryPop& value) {
-		auto& dest = getDestination(value);
+	template<Address capacity>
+	void Core::invoke(OperationTag<OperationKind::MemoryPop>, const Instruction& value) {
+		auto dest = getDestination(value);
 		if (auto lowerMask = value.getLowerMask(); lowerMask != 0) {
-			dest.setLowerHalf(popParameterWord() & lowerMask);
+			dest.setLowerHalf(popParameterWord<capacity>() & lowerMask);
 		}
 		if (auto upperMask = value.getUpperMask(); upperMask != 0) {
-			dest.setUpperHalf(popParameterWord() & upperMask);
+			dest.setUpperHalf(popParameterWord<capacity>() & upperMask);
 		}
 	}
 
-	void Core::invoke(const Core::MemoryPush& value) {
-		auto& dest = getDestination(value);
+	template<Address capacity>
+	void Core::invoke(OperationTag<OperationKind::MemoryPush>, const Instruction& value) {
+		auto dest = getDestination(value);
 		if (auto upperMask = value.getUpperMask(); upperMask != 0) {
-			pushParameterWord(dest.getUpperHalf() & upperMask);
+			pushParameterWord<capacity>(dest.getUpperHalf() & upperMask);
 		}
 		if (auto lowerMask = value.getLowerMask(); lowerMask != 0) {
-			pushParameterWord(dest.getLowerHalf() & lowerMask);
+			pushParameterWord<capacity>(dest.getLowerHalf() & lowerMask);
 		}
 	}
 
-	void Core::invoke(const Core::MemoryStore& value) {
+	template<Address capacity>
+	void Core::invoke(OperationTag<OperationKind::MemoryStore>, const Instruction& value) {
 		auto addr = getAddressRegister().getAddress() + value.getMemoryOffset();
-		auto& val = getValueRegister();
+		auto val = getValueRegister();
 		auto lowerMask = value.getLowerMask();
 		auto upperMask = value.getUpperMask();
 		if (lowerMask == 0 && upperMask == 0) {
 		} else if (lowerMask == 0xFFFF && upperMask == 0) {
-			storeWord(addr, MemoryWord((val.getAddress() & 0x0000FFFF)));
+			storeWord<capacity>(addr, MemoryWord((val.getAddress() & 0x0000FFFF)));
 		} else if (lowerMask == 0x0000 && upperMask == 0xFFFF) {
-			storeWord(addr + 1, MemoryWord((val.getAddress() & 0xFFFF0000) >> 16));
+			storeWord<capacity>(addr + 1, MemoryWord((val.getAddress() & 0xFFFF0000) >> 16));
 		} else if (lowerMask == 0xFFFF && upperMask == 0xFFFF) {
             storeAddress(addr, val.getAddress());
 		} else {
 			if (lowerMask != 0) {
-				auto value = loadWord(addr) & ~lowerMask;
+				auto value = loadWord<capacity>(addr) & ~lowerMask;
 				auto newValue = val.getLowerHalf() & lowerMask;
-				storeWord(addr, value | newValue);
+				storeWord<capacity>(addr, value | newValue);
 			} 
 			if (upperMask != 0) {
-				auto value = loadWord(addr + 1) & ~upperMask;
+				auto value = loadWord<capacity>(addr + 1) & ~upperMask;
 				auto newValue = val.getUpperHalf() & upperMask;
-				storeWord(addr + 1, value | newValue);
+				storeWord<capacity>(addr + 1, value | newValue);
 			}
 		}
 	}
 
-	void Core::invoke(const Core::MemoryLoad& value) {
+	template<Address capacity>
+	void Core::invoke(OperationTag<OperationKind::MemoryLoad>, const Instruction& value) {
 		auto addr = getAddressRegister().getAddress() + value.getMemoryOffset();
-		auto& val = getValueRegister();
-		bool readLower = false;
-		bool readUpper = false;
-		switch (value.getBitmask()) {
-			case 0b0000:
-				break;
-			case 0b0001:
-			case 0b0010:
-			case 0b0011:
-				// lower half only!
-				readLower = true;
-				break;
-			case 0b0100:
-			case 0b1000:
-			case 0b1100:
-				readUpper = true;
-				break;
-			default:
-				readLower = true;
-				readUpper = true;
-				break;
-		}
-		auto lower = readLower ? Address(loadWord(addr)) : 0;
-		auto upper = readUpper ? Address(loadWord(addr + 1)) << 16 : 0;
+		auto val = getValueRegister();
+		// only read the halves which the mask actually selects
+		auto lower = value.getLowerMask() != 0 ? Address(loadWord<capacity>(addr)) : 0;
+		auto upper = value.getUpperMask() != 0 ? Address(loadWord<capacity>(addr + 1)) << 16 : 0;
 		val.setInteger((lower | upper) & value.getExpandedBitmask());
 	}
 
-	void Core::invoke(const Core::Branch& value) {
-		variantInvoke(value);
-	}
-
-	void Core::invoke(const Core::BranchRegister& value) {
-		auto whereToGo = getDestination(value).getAddress();
+	template<Address capacity>
+	void Core::branch(const Core::Instruction& value, Address whereToGo) {
 		auto updatePC = value.performCall() || (value.conditionallyEvaluate() && _conditionRegister) || (!value.conditionallyEvaluate());
 		if (value.performCall()) {
             // call instruction
@@ -279,33 +631,35 @@ namespace cisc0 {
             // Once done, we then push the next address following the newly
             // modified ip to the stack. Then we update the ip of where we are
             // going to go!
-			pushSubroutineAddress(getPC().getAddress());
+			pushSubroutineAddress<capacity>(getPC().getAddress());
 		}
-		if (updatePC) {
-			getPC().setAddress(whereToGo);
-		}
-	}
-
-	void Core::invoke(const Core::BranchImmediate& value) {
-		auto whereToGo = value.getImmediate();
-		auto updatePC = value.performCall() || (value.conditionallyEvaluate() && _conditionRegister) || (!value.conditionallyEvaluate());
+#if CISC0_COUNTERS
 		if (value.performCall()) {
-            // call instruction
-            // figure out where we are going to go, this will cause loads and
-            // incrementation of the instruction pointer.
-            // Once done, we then push the next address following the newly
-            // modified ip to the stack. Then we update the ip of where we are
-            // going to go!
-			pushSubroutineAddress(getPC().getAddress());
+			++_statistics._calls;
+		} else if (updatePC) {
+			++_statistics._branchesTaken;
+		} else {
+			++_statistics._branchesNotTaken;
 		}
+#endif
 		if (updatePC) {
-			getPC().setAddress(whereToGo);
+			if (_jit) {
+				noteBranchTarget(whereToGo, value.performCall());
+			}
+			setPC<capacity>(whereToGo);
 		}
 	}
 
-	void Core::invoke(const Core::Shift& value) {
-		variantInvoke(value);
+	template<Address capacity>
+	void Core::invoke(OperationTag<OperationKind::BranchRegister>, const Instruction& value) {
+		branch<capacity>(value, getDestination(value).getAddress());
 	}
+
+	template<Address capacity>
+	void Core::invoke(OperationTag<OperationKind::BranchImmediate>, const Instruction& value) {
+		branch<capacity>(value, value.getImmediate());
+	}
+
 	constexpr Address performShift(bool shiftLeft, Address base, Address shift) noexcept {
 		if (shiftLeft) {
 			return base << shift;
@@ -313,119 +667,57 @@ namespace cisc0 {
 			return base >> shift;
 		}
 	}
-	void Core::invoke(const Core::ShiftRegister& value) {
-		auto& dest = getDestination(value);
-		auto& src = getSource(value);
-		dest.setAddress(performShift(value.shiftLeft(), dest.getAddress(), src.getAddress()));
+	void Core::shift(const Core::Instruction& value, Address amount) {
+		auto dest = getDestination(value);
+		dest.setAddress(performShift(value.shiftLeft(), dest.getAddress(), amount));
 	}
 
-	void Core::invoke(const Core::ShiftImmediate& value) {
-		auto& dest = getDestination(value);
-		dest.setAddress(performShift(value.shiftLeft(), dest.getAddress(), value.getShiftAmount()));
+	template<Address capacity>
+	void Core::invoke(OperationTag<OperationKind::ShiftRegister>, const Instruction& value) {
+		shift(value, getSource(value).getAddress());
 	}
 
-	void Core::invoke(const Core::Logical& value) {
-		variantInvoke(value);
-	}
-
-	void Core::invoke(const Core::LogicalRegister& value) {
-		auto& dest = getDestination(value);
-		auto& src = getSource(value);
-		switch (value.getStyle()) {
-			case LogicalStyle::And:
-				dest.setAddress(dest.getAddress() & src.getAddress());
-				break;
-			case LogicalStyle::Or:
-				dest.setAddress(dest.getAddress() | src.getAddress());
-				break;
-			case LogicalStyle::Xor:
-				dest.setAddress(dest.getAddress() ^ src.getAddress());
-				break;
-			case LogicalStyle::Not:
-				dest.setAddress(~src.getAddress());
-				break;
-			case LogicalStyle::Nand:
-				dest.setAddress(~(dest.getAddress() & src.getAddress()));
-				break;
-			default:
-				throw Problem("Illegal logical style!");
-		}
+	template<Address capacity>
+	void Core::invoke(OperationTag<OperationKind::ShiftImmediate>, const Instruction& value) {
+		shift(value, value.getShiftAmount());
 	}
 
-	void Core::invoke(const Core::LogicalImmediate& value) {
-		auto& dest = getDestination(value);
-		switch (value.getStyle()) {
+	void Core::logical(const Core::Instruction& value, Address src) {
+		auto dest = getDestination(value);
+		switch (value.getStyle<LogicalStyle>()) {
 			case LogicalStyle::And:
-				dest.setAddress(dest.getAddress() & value.getImmediate());
+				dest.setAddress(dest.getAddress() & src);
 				break;
 			case LogicalStyle::Or:
-				dest.setAddress(dest.getAddress() | value.getImmediate());
+				dest.setAddress(dest.getAddress() | src);
 				break;
 			case LogicalStyle::Xor:
-				dest.setAddress(dest.getAddress() ^ value.getImmediate());
+				dest.setAddress(dest.getAddress() ^ src);
 				break;
 			case LogicalStyle::Not:
-				dest.setAddress(~value.getImmediate());
+				dest.setAddress(~src);
 				break;
 			case LogicalStyle::Nand:
-				dest.setAddress(~(dest.getAddress() & value.getImmediate()));
+				dest.setAddress(~(dest.getAddress() & src));
 				break;
 			default:
 				throw Problem("Illegal logical style!");
 		}
-
 	}
 
-	void Core::invoke(const Core::Arithmetic& value) {
-		variantInvoke(value);
+	template<Address capacity>
+	void Core::invoke(OperationTag<OperationKind::LogicalRegister>, const Instruction& value) {
+		logical(value, getSource(value).getAddress());
 	}
 
-	void Core::invoke(const Core::ArithmeticRegister& value) {
-		auto& dest = getDestination(value);
-		auto& src = getSource(value);
-		using T = decltype(value.getStyle());
-		auto remainderOp = [](auto numerator, auto denominator) {
-			if (denominator == 0) {
-				throw Problem("Divide by zero!");
-			}
-			return numerator % denominator;
-		};
-		auto divOp = [](auto numerator, auto denominator) {
-			if (denominator == 0) {
-				throw Problem("Divide by zero!");
-			}
-			return numerator / denominator;
-		};
-		// TODO: add support for signed operations
-		switch (value.getStyle()) {
-			case T::Min:
-				getValueRegister().setAddress(dest.getAddress() > src.getAddress() ? src.getAddress() : dest.getAddress());
-				break;
-			case T::Max:
-				getValueRegister().setAddress(dest.getAddress() > src.getAddress() ? dest.getAddress() : src.getAddress());
-				break;
-			case T::Rem:
-				dest.setAddress(remainderOp(dest.getAddress(), src.getAddress()));
-				break;
-			case T::Div:
-				dest.setAddress(divOp(dest.getAddress(), src.getAddress()));
-				break;
-			case T::Mul:
-				dest.setAddress(dest.getAddress() * src.getAddress());
-				break;
-			case T::Add:
-				dest.setAddress(dest.getAddress() + src.getAddress());
-				break;
-			case T::Sub:
-				dest.setAddress(dest.getAddress() - src.getAddress());
-				break;
-		}
+	template<Address capacity>
+	void Core::invoke(OperationTag<OperationKind::LogicalImmediate>, const Instruction& value) {
+		logical(value, value.getImmediate());
 	}
 
-	void Core::invoke(const Core::ArithmeticImmediate& value) {
-		auto& dest = getDestination(value);
-		auto src = value.getImmediate();
-		using T = decltype(value.getStyle());
+	void Core::arithmetic(const Core::Instruction& value, Address src) {
+		auto dest = getDestination(value);
+		using T = ArithmeticStyle;
 		auto remainderOp = [](auto numerator, auto denominator) {
 			if (denominator == 0) {
 				throw Problem("Divide by zero!");
@@ -439,7 +731,7 @@ namespace cisc0 {
 			return numerator / denominator;
 		};
 		// TODO: add support for signed operations
-		switch (value.getStyle()) {
+		switch (value.getStyle<T>()) {
 			case T::Min:
 				getValueRegister().setAddress(dest.getAddress() > src ? src : dest.getAddress());
 				break;
@@ -464,43 +756,20 @@ namespace cisc0 {
 		}
 	}
 
-	void Core::invoke(const Core::Compare& value) {
-		variantInvoke(value);
+	template<Address capacity>
+	void Core::invoke(OperationTag<OperationKind::ArithmeticRegister>, const Instruction& value) {
+		arithmetic(value, getSource(value).getAddress());
 	}
 
-	void Core::invoke(const Core::CompareRegister& value) {
-		auto& dest = getDestination(value);
-		auto& src = getSource(value);
-		using T = decltype(value.getStyle());
-		switch (value.getStyle()) {
-			case T::LessThanOrEqualTo:
-				_conditionRegister = dest.getAddress() <= src.getAddress();
-				break;
-			case T::GreaterThanOrEqualTo:
-				_conditionRegister = dest.getAddress() >= src.getAddress();
-				break;
-			case T::LessThan:
-				_conditionRegister = dest.getAddress() < src.getAddress();
-				break;
-			case T::GreaterThan:
-				_conditionRegister = dest.getAddress() > src.getAddress();
-				break;
-			case T::Equals:
-				_conditionRegister = dest.getAddress() == src.getAddress();
-				break;
-			case T::NotEquals:
-				_conditionRegister = dest.getAddress() != src.getAddress();
-				break;
-			default:
-				throw Problem("This should never be thrown! An illegal operation found its way here!");
-		}
+	template<Address capacity>
+	void Core::invoke(OperationTag<OperationKind::ArithmeticImmediate>, const Instruction& value) {
+		arithmetic(value, value.getImmediate());
 	}
 
-	void Core::invoke(const Core::CompareImmediate& value) {
-		auto& dest = getDestination(value);
-		auto src = value.getImmediate();
-		using T = decltype(value.getStyle());
-		switch (value.getStyle()) {
+	void Core::compare(const Core::Instruction& value, Address src) {
+		auto dest = getDestination(value);
+		using T = CompareStyle;
+		switch (value.getStyle<T>()) {
 			case T::LessThanOrEqualTo:
 				_conditionRegister = dest.getAddress() <= src;
 				break;
@@ -523,236 +792,753 @@ namespace cisc0 {
 				throw Problem("This should never be thrown! An illegal operation found its way here!");
 		}
 	}
-	void Core::invoke(const Core::CompareMoveToCondition& value) {
-		_conditionRegister = getDestination(value).getTruth();
+
+	template<Address capacity>
+	void Core::invoke(OperationTag<OperationKind::CompareRegister>, const Instruction& value) {
+		compare(value, getSource(value).getAddress());
 	}
-	void Core::invoke(const Core::CompareMoveFromCondition& value) {
-		getDestination(value).setInteger(_conditionRegister ? -1 : 0);
+
+	template<Address capacity>
+	void Core::invoke(OperationTag<OperationKind::CompareImmediate>, const Instruction& value) {
+		compare(value, value.getImmediate());
 	}
 
-	void Core::invoke(const Core::Operation& value) {
-		variantInvoke(value);
+	template<Address capacity>
+	void Core::invoke(OperationTag<OperationKind::CompareMoveToCondition>, const Instruction& value) {
+		_conditionRegister = getDestination(value).getTruth();
 	}
-	constexpr Core::OperationCode getOpcode(MemoryWord input) noexcept {
-		return Core::OperationCode(input & 0b1111);
+
+	template<Address capacity>
+	void Core::invoke(OperationTag<OperationKind::CompareMoveFromCondition>, const Instruction& value) {
+		getDestination(value).setInteger(_conditionRegister ? -1 : 0);
 	}
-	Core::Operation Core::decode() {
-		Core::Operation out;
-		auto first = nextWord();
-		using T = Core::OperationCode;
-		switch (getOpcode(first)) {
-			case T::Swap:
-				out = Swap();
+
+	template<Address capacity>
+	Core::Instruction Core::decode() {
+		auto result = firstWordTable[nextWord<capacity>()];
+		switch (result.getLength()) {
+			case 2:
+				result.setExtensionWords(nextWord<capacity>());
 				break;
-			case T::Shift:
-				out = Shift();
+			case 3: {
+				// fetch the extension words in order
+				auto second = nextWord<capacity>();
+				auto third = nextWord<capacity>();
+				result.setExtensionWords(second, third);
 				break;
-			case T::Memory:
-				out = Memory();
+			}
+			default:
 				break;
-			case T::Branch:
-				out = Branch();
+		}
+		return result;
+	}
+
+	template<Address capacity, Core::OperationKind kind>
+	void Core::retire(const Core::Instruction& value) {
+#if CISC0_COUNTERS
+		++_statistics._kinds[byte(kind)];
+		++_statistics._variants[byte(kind)][getVariant(value)];
+#if CISC0_COUNTER_TIMING
+		auto start = std::chrono::steady_clock::now();
+		invoke<capacity>(OperationTag<kind>(), value);
+		_statistics._nanoseconds[byte(kind)] += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		return;
+#endif
+#endif
+		invoke<capacity>(OperationTag<kind>(), value);
+	}
+
+	template<Address capacity>
+	void Core::execute(const Core::Instruction& value) {
+		using T = OperationKind;
+		switch (value.getKind()) {
+			case T::CompareRegister:
+				retire<capacity, T::CompareRegister>(value);
 				break;
-			case T::Logical:
-				out = Logical();
+			case T::CompareImmediate:
+				retire<capacity, T::CompareImmediate>(value);
 				break;
-			case T::Move:
-				out = Move();
+			case T::CompareMoveFromCondition:
+				retire<capacity, T::CompareMoveFromCondition>(value);
+				break;
+			case T::CompareMoveToCondition:
+				retire<capacity, T::CompareMoveToCondition>(value);
+				break;
+			case T::ArithmeticRegister:
+				retire<capacity, T::ArithmeticRegister>(value);
+				break;
+			case T::ArithmeticImmediate:
+				retire<capacity, T::ArithmeticImmediate>(value);
+				break;
+			case T::LogicalRegister:
+				retire<capacity, T::LogicalRegister>(value);
+				break;
+			case T::LogicalImmediate:
+				retire<capacity, T::LogicalImmediate>(value);
+				break;
+			case T::ShiftRegister:
+				retire<capacity, T::ShiftRegister>(value);
+				break;
+			case T::ShiftImmediate:
+				retire<capacity, T::ShiftImmediate>(value);
+				break;
+			case T::BranchRegister:
+				retire<capacity, T::BranchRegister>(value);
+				break;
+			case T::BranchImmediate:
+				retire<capacity, T::BranchImmediate>(value);
+				break;
+			case T::MemoryLoad:
+				retire<capacity, T::MemoryLoad>(value);
+				break;
+			case T::MemoryStore:
+				retire<capacity, T::MemoryStore>(value);
 				break;
-			case T::Arithmetic:
-				out = Arithmetic();
+			case T::MemoryPush:
+				retire<capacity, T::MemoryPush>(value);
+				break;
+			case T::MemoryPop:
+				retire<capacity, T::MemoryPop>(value);
+				break;
+			case T::Move:
+				retire<capacity, T::Move>(value);
 				break;
 			case T::Set:
-				out = Set();
+				retire<capacity, T::Set>(value);
 				break;
-			case T::Misc:
-				out = Misc();
+			case T::Swap:
+				retire<capacity, T::Swap>(value);
 				break;
-			case T::Compare:
-				out = Compare();
+			case T::Return:
+				retire<capacity, T::Return>(value);
 				break;
-			default:
-				throw Problem("Illegal Opcode!");
-		}
-		std::visit([this, first](auto&& value) { decode(first, value); }, out);
-		return out;
-	}
-
-	void Core::decode(MemoryWord first, Core::Return& value) { }
-
-	void Core::decode(MemoryWord first, Core::Terminate& value) { }
-
-	constexpr Core::MiscStyle getMiscStyle(MemoryWord word) noexcept {
-		return Core::MiscStyle((0b11110000 & word) >> 4);
-	}
-	void Core::decode(MemoryWord first, Core::Misc& value) {
-		using T = Core::MiscStyle;
-		switch (getMiscStyle(first)) {
 			case T::Terminate:
-				value = Core::Terminate();
+				retire<capacity, T::Terminate>(value);
+				break;
+			case T::PutCharacter:
+				retire<capacity, T::PutCharacter>(value);
+				break;
+			case T::GetCharacter:
+				retire<capacity, T::GetCharacter>(value);
+				break;
+			case T::ReadWord:
+				retire<capacity, T::ReadWord>(value);
+				break;
+			case T::StringEquals:
+				retire<capacity, T::StringEquals>(value);
+				break;
+			case T::StringCopy:
+				retire<capacity, T::StringCopy>(value);
+				break;
+			case T::ReadBuffer:
+				retire<capacity, T::ReadBuffer>(value);
+				break;
+			case T::WriteBuffer:
+				retire<capacity, T::WriteBuffer>(value);
+				break;
+			case T::BlockCopy:
+				retire<capacity, T::BlockCopy>(value);
+				break;
+			case T::BlockFill:
+				retire<capacity, T::BlockFill>(value);
+				break;
+			case T::BlockCompare:
+				retire<capacity, T::BlockCompare>(value);
+				break;
+			case T::BlockSearch:
+				retire<capacity, T::BlockSearch>(value);
+				break;
+			case T::IllegalOpcode:
+				retire<capacity, T::IllegalOpcode>(value);
+				break;
+			case T::IllegalMisc:
+				retire<capacity, T::IllegalMisc>(value);
 				break;
-			case T::Return:
-				value = Core::Return();
-				break;
-            case T::GetCharacter:
-                value = Core::GetCharacter();
-                break;
-            case T::PutCharacter:
-                value = Core::PutCharacter();
-                break;
-            case T::ReadWord:
-                value = Core::ReadWord();
-                break;
-            case T::StringCopy:
-                value = Core::StringCopy();
-                break;
-            case T::StringEquals:
-                value = Core::StringEquals();
-                break;
 			default:
-				throw Problem("Undefined or unimplemented misc operation!");
+				throw Problem("Illegal Opcode!");
 		}
-        std::visit([this, first](auto&& x) { decode(first, x); }, value);
-	}
-
-	void Core::decode(MemoryWord first, Core::Swap& value) {
-		value.extract(first);
 	}
 
-	void Core::decode(MemoryWord first, Core::Set& value) {
-		value.extract(first);
-	}
-
-	void Core::decode(MemoryWord first, Core::Move& value) {
-		value.extract(first);
+	template<Address capacity>
+	void Core::invokeFused(OperationTag<OperationKind::FusedCompareBranch>, const CachedInstruction& entry) {
+		auto& first = entry._instruction;
+#if CISC0_COUNTERS
+		// the compare is carried out inline rather than retired, so it is
+		// counted and timed here the same way retire would
+		++_statistics._kinds[byte(first.getKind())];
+		++_statistics._variants[byte(first.getKind())][getVariant(first)];
+#if CISC0_COUNTER_TIMING
+		auto start = std::chrono::steady_clock::now();
+#endif
+#endif
+		compare(first, first.getKind() == OperationKind::CompareImmediate ? first.getImmediate() : getSource(first).getAddress());
+#if CISC0_COUNTERS && CISC0_COUNTER_TIMING
+		_statistics._nanoseconds[byte(first.getKind())] += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+#endif
+		retire<capacity, OperationKind::BranchImmediate>(entry._second);
+		++_statistics._fusedCompareBranches;
+	}
+
+	template<Address capacity>
+	void Core::invokeFused(OperationTag<OperationKind::FusedSetMemory>, const CachedInstruction& entry) {
+		retire<capacity, OperationKind::Set>(entry._instruction);
+		if (entry._second.getKind() == OperationKind::MemoryLoad) {
+			retire<capacity, OperationKind::MemoryLoad>(entry._second);
+		} else {
+			retire<capacity, OperationKind::MemoryStore>(entry._second);
+		}
+		++_statistics._fusedSetMemories;
 	}
 
-	void Core::decode(MemoryWord first, Core::Memory& value) {
-		auto target = extractStyle<Core::MemoryStyle>(first, 0b1100000, 5);
-		using T = decltype(target);
-		switch (target) {
-			case T::Push:
-				value = Core::MemoryPush();
-				break;
-			case T::Pop:
-				value = Core::MemoryPop();
+	template<Address capacity>
+	void Core::execute(const Core::CachedInstruction& entry) {
+		switch (entry._handler) {
+			case OperationKind::FusedCompareBranch:
+				invokeFused<capacity>(OperationTag<OperationKind::FusedCompareBranch>(), entry);
 				break;
-			case T::Load:
-				value = Core::MemoryLoad();
+			case OperationKind::FusedSetMemory:
+				invokeFused<capacity>(OperationTag<OperationKind::FusedSetMemory>(), entry);
 				break;
-			case T::Store:
-				value = Core::MemoryStore();
+			default:
+				execute<capacity>(entry._instruction);
 				break;
 		}
-		std::visit([this, first](auto&& x) { decode(first, x); }, value);
-	}
-
-	void Core::decode(MemoryWord first, Core::MemoryPop& value) {
-		value.extract(first);
-	}
-
-	void Core::decode(MemoryWord first, Core::MemoryPush& value) {
-		value.extract(first);
 	}
 
-	void Core::decode(MemoryWord first, Core::MemoryStore& value) {
-		value.extract(first);
-	}
-
-	void Core::decode(MemoryWord first, Core::MemoryLoad& value) {
-		value.extract(first);
-	}
-
-	void Core::decode(MemoryWord first, Core::Branch& value) {
-		decodeOnImmediateBit<decltype(value), Core::BranchImmediate, Core::BranchRegister>(first, value);
-	}
-
-	void Core::decode(MemoryWord first, Core::BranchRegister& value) {
-		value.extract(first);
-	}
-
-	void Core::decode(MemoryWord first, Core::BranchImmediate& value) {
-		value.extract(first, nextWord(), nextWord());
-	}
-
-	void Core::decode(MemoryWord first, Core::Shift& value) {
-		decodeOnImmediateBit<decltype(value), Core::ShiftImmediate, Core::ShiftRegister>(first, value);
-	}
-
-	void Core::decode(MemoryWord first, Core::ShiftRegister& value) {
-		value.extract(first);
+	template<Address capacity>
+	const Core::CachedInstruction& Core::fetch() {
+		auto address = _registers.get(ArchitectureConstants::InstructionPointer);
+		auto& entry = _decodeCache[address & (decodeCacheSize - 1)];
+		if (entry._valid && entry._address == address) {
+			// every word fetched walks the instruction pointer back by one
+			setPC<capacity>(address - entry.getLength());
+		} else {
+			entry._valid = false;
+			entry._instruction = decode<capacity>();
+			entry._handler = entry._instruction.getKind();
+			entry._address = address;
+			entry._block = _jit ? _jit->find(address) : nullptr;
+			fuse<capacity>(entry);
+			entry._valid = true;
+		}
+		++_statistics._dispatches;
+		return entry;
+	}
+	template<Address capacity>
+	void Core::fuse(CachedInstruction& entry) {
+		using K = OperationKind;
+		auto& first = entry._instruction;
+		auto handler = first.getKind();
+		switch (handler) {
+			case K::CompareRegister:
+			case K::CompareImmediate:
+				// the instruction pointer would already be past the branch,
+				// the source field of an immediate compare is its bitmask
+				if (first.getDestination() == ArchitectureConstants::InstructionPointer ||
+					(handler == K::CompareRegister && first.getSource() == ArchitectureConstants::InstructionPointer)) {
+					return;
+				}
+				handler = K::FusedCompareBranch;
+				break;
+			case K::Set:
+				if (first.getDestination() != ArchitectureConstants::AddressRegister) {
+					return;
+				}
+				handler = K::FusedSetMemory;
+				break;
+			default:
+				return;
+		}
+		auto pc = getPC();
+		auto resumeAt = pc.getAddress();
+		auto second = decode<capacity>();
+		auto kind = second.getKind();
+		auto pairs = (handler == K::FusedCompareBranch) ?
+			(kind == K::BranchImmediate && second.conditionallyEvaluate()) :
+			(kind == K::MemoryLoad || kind == K::MemoryStore);
+		if (pairs) {
+			entry._second = second;
+			entry._handler = handler;
+		} else {
+			pc.setAddress(resumeAt);
+		}
 	}
-
-	void Core::decode(MemoryWord first, Core::ShiftImmediate& value) {
-		value.extract(first);
+	void Core::invalidateDecodeCache(Address addr) noexcept {
+		// an instruction starting at address s occupies s, s - 1, and s - 2
+		// and a fused pair up to three more words below that, so check
+		// every start address which could have covered addr
+		for (Address offset = 0; offset < 6; ++offset) {
+			auto start = (addr + offset) & (_capacity - 1);
+			auto& entry = _decodeCache[start & (decodeCacheSize - 1)];
+			if (entry._valid && entry._address == start && entry.getLength() > offset) {
+				entry._valid = false;
+			}
+		}
 	}
-
-	void Core::decode(MemoryWord first, Core::Logical& value) {
-		decodeOnImmediateBit<decltype(value), Core::LogicalImmediate, Core::LogicalRegister>(first, value);
+	void Core::flushDecodeCache() noexcept {
+		if (_decodeCache) {
+			for (Address i = 0; i < decodeCacheSize; ++i) {
+				_decodeCache[i]._valid = false;
+			}
+		}
 	}
 
-	void Core::decode(MemoryWord first, Core::LogicalRegister& value) {
-		value.extract(first);
+	void Core::setExecutionEngine(ExecutionEngine engine) {
+		_engine = engine;
+		// compiled blocks would hide their instructions from the counters
+		if (_engine == ExecutionEngine::Tiered && Jit::supported() && _decodeCache && !_jit && !countersEnabled) {
+			_jit = std::make_unique<Jit>();
+			_branchTargetCounts = std::make_unique<uint16_t[]>(decodeCacheSize);
+		}
 	}
-
-	void Core::decode(MemoryWord first, Core::LogicalImmediate& value) {
-		decodeImmediateValue(first, value);
+	void Core::run() {
+		try {
+			if (_trace) {
+				runTraced();
+			} else if (_profiler) {
+				runProfiled();
+			} else if (_memory.getReservation() && _devices.empty()) {
+				runGuarded();
+			} else if (_capacity == defaultMemoryCapacity) {
+				// the usual capacity gets an engine with it baked in
+				runEngine<defaultMemoryCapacity>();
+			} else {
+				runEngine<dynamicCapacity>();
+			}
+		} catch (...) {
+			// the guest's last words are usually the most useful ones
+			_output->flush();
+			throw;
+		}
+		_output->flush();
+	}
+	template<Address capacity>
+	void Core::runEngine() {
+		switch (_engine) {
+			case ExecutionEngine::Tiered:
+				if (_jit) {
+					runTiered<capacity>();
+					break;
+				}
+				[[fallthrough]];
+			case ExecutionEngine::Threaded:
+				// the threaded engine needs the decode cache to hold the kind
+				if (_decodeCache) {
+					runThreaded<capacity>();
+					break;
+				}
+				[[fallthrough]];
+			default:
+				runStandard<capacity>();
+				break;
+		}
 	}
-
-	void Core::decode(MemoryWord first, Core::Arithmetic& value) {
-		decodeOnImmediateBit<decltype(value), Core::ArithmeticImmediate, Core::ArithmeticRegister>(first, value);
+	template<Address capacity>
+	void Core::runStandard() {
+		if (_decodeCache) {
+			while (_keepExecuting) {
+				execute<capacity>(fetch<capacity>());
+			}
+		} else {
+			while (_keepExecuting) {
+				auto instruction = decode<capacity>();
+				// counted up front just like fetch so console events see the same count
+				++_statistics._dispatches;
+				execute<capacity>(instruction);
+			}
+		}
 	}
-
-	void Core::decode(MemoryWord first, Core::ArithmeticRegister& value) {
-		value.extract(first);
+	template<Address capacity>
+	void Core::runTiered() {
+		while (_keepExecuting) {
+			auto& current = fetch<capacity>();
+			if (current._block) {
+				current._block->_code(_registers.data(), &_conditionRegister);
+				setPC<capacity>(current._block->_end);
+				++_statistics._compiledBlocks;
+				_statistics._compiledInstructions += current._block->_instructionCount;
+			} else {
+				execute<capacity>(current);
+			}
+		}
 	}
-
-	void Core::decode(MemoryWord first, Core::ArithmeticImmediate& value) {
-		decodeImmediateValue(first, value);
+	void Core::runProfiled() {
+		auto interval = _profiler->getInterval();
+		// an interval of zero leaves sampling to the timer alone, otherwise
+		// it is measured in retired instructions rather than dispatches
+		auto nextSample = [this, interval]() {
+			return interval == 0 ? ~uint64_t(0) : _statistics.getInstructionCount() + interval;
+		};
+		auto sampleAt = nextSample();
+		while (_keepExecuting) {
+			if (_statistics.getInstructionCount() >= sampleAt || _profiler->sampleRequested()) {
+				_profiler->record(getPC().getAddress());
+				sampleAt = nextSample();
+			}
+			if (_decodeCache) {
+				auto pc = getPC().getAddress();
+				auto& entry = fetch();
+				if (entry.isFused()) {
+					// run one instruction at a time so the second half of a
+					// pair gets sampled at its own address too
+					setPC<dynamicCapacity>(pc - entry._instruction.getLength());
+					execute(entry._instruction);
+				} else {
+					execute(entry);
+				}
+			} else {
+				auto instruction = decode();
+				++_statistics._dispatches;
+				execute(instruction);
+			}
+		}
 	}
-
-	void Core::decode(MemoryWord first, Core::Compare& value) {
-		auto style = Core::extractStyle<Core::CompareStyle>(first);
-		using T = decltype(style);
-		switch (style) {
-			case T::MoveToCondition:
-				value = CompareMoveToCondition();
-				break;
-			case T::MoveFromCondition:
-				value = CompareMoveFromCondition();
-				break;
-			default: 
-				if (extractImmediateBit(first)) {
-					value = CompareImmediate();
+	void Core::runTraced() {
+		try {
+			while (_keepExecuting) {
+				auto pc = getPC().getAddress();
+				Instruction instruction;
+				if (_decodeCache) {
+					auto& entry = fetch();
+					if (entry.isFused()) {
+						// traced one instruction at a time, the second one
+						// gets decoded into an entry of its own next time around
+						setPC<dynamicCapacity>(pc - entry._instruction.getLength());
+					}
+					instruction = entry._instruction;
 				} else {
-					value = CompareRegister();
+					instruction = decode();
+					++_statistics._dispatches;
+				}
+				MemoryWord words[3] = { 0 };
+				auto addr = pc;
+				for (byte i = 0; i < instruction.getLength(); ++i) {
+					// decode already checked these are in bounds
+					words[i] = _memory.load(addr);
+					// wrap the same way nextWord moves the instruction pointer
+					addr = (addr + _capacity - 1) & _registers.getMask(ArchitectureConstants::InstructionPointer);
 				}
-				break; 
+				_trace->beginInstruction(pc, words, instruction.getLength());
+				execute(instruction);
+				_trace->endInstruction(instruction.getDestination(), getRegister(instruction.getDestination()).getAddress());
+			}
+		} catch (...) {
+			// keep everything up to the instruction which failed
+			_trace->finish();
+			throw;
 		}
-		std::visit([this, first](auto&& value) { decode(first, value); }, value);
 	}
-
-	void Core::decode(MemoryWord first, Core::CompareRegister& value) {
-		value.extract(first);
+	namespace {
+		/// where a guarded run on this thread goes when it faults
+		thread_local sigjmp_buf* guardedRun = nullptr;
+		thread_local const PagedMemory* guardedMemory = nullptr;
+		struct sigaction previousFaultHandler;
+		void onFault(int number, siginfo_t* info, void* context) {
+			if (guardedRun && guardedMemory->inReservation(info->si_addr)) {
+				siglongjmp(*guardedRun, 1);
+			}
+			// not ours, hand it to whoever was installed before while
+			// staying installed for the guarded runs still to come
+			if (previousFaultHandler.sa_flags & SA_SIGINFO) {
+				previousFaultHandler.sa_sigaction(number, info, context);
+			} else if (previousFaultHandler.sa_handler != SIG_DFL && previousFaultHandler.sa_handler != SIG_IGN) {
+				previousFaultHandler.sa_handler(number);
+			} else {
+				// a fault can't be ignored, returning with the default
+				// action in place lets the access fault again and end
+				// the process like it would have without us
+				struct sigaction fallback;
+				std::memset(&fallback, 0, sizeof(fallback));
+				fallback.sa_handler = SIG_DFL;
+				sigemptyset(&fallback.sa_mask);
+				sigaction(SIGSEGV, &fallback, nullptr);
+			}
+		}
+		void installFaultHandler() {
+			static std::once_flag installed;
+			std::call_once(installed, []() {
+				struct sigaction action;
+				std::memset(&action, 0, sizeof(action));
+				action.sa_sigaction = onFault;
+				action.sa_flags = SA_SIGINFO;
+				sigemptyset(&action.sa_mask);
+				if (sigaction(SIGSEGV, &action, &previousFaultHandler) != 0) {
+					throw Problem("Unable to install the guarded memory fault handler!");
+				}
+			});
+		}
+	} // end namespace
+	void Core::setMemoryBackend(MemoryBackend backend) {
+		if (backend == MemoryBackend::Guarded) {
+			installFaultHandler();
+			_memory.reserve(_capacity);
+		} else {
+			_memory.release();
+		}
+		flushDecodeCache();
+		flushCompiledBlocks();
+	}
+	void Core::runGuarded() {
+		// everything between here and the faulting access has trivial
+		// destructors, the engines for guarded memory only touch memory
+		// through loadWord and storeWord and those go straight to it
+		sigjmp_buf recover;
+		if (sigsetjmp(recover, 1) != 0) {
+			guardedRun = nullptr;
+			guardedMemory = nullptr;
+			throw Problem("Illegal address!");
+		}
+		guardedRun = &recover;
+		guardedMemory = &_memory;
+		try {
+			runEngine<guardedCapacity>();
+		} catch (...) {
+			guardedRun = nullptr;
+			guardedMemory = nullptr;
+			throw;
+		}
+		guardedRun = nullptr;
+		guardedMemory = nullptr;
 	}
-
-	void Core::decode(MemoryWord first, Core::CompareImmediate& value) {
-		decodeImmediateValue(first, value);
+	void Core::noteBranchTarget(Address target, bool isCall) {
+		// instructions are laid out walking downward through memory so a
+		// branch to a higher address goes backward and is likely a loop
+		if (!isCall && target < getPC().getAddress()) {
+			return;
+		}
+		if (++_branchTargetCounts[target & (decodeCacheSize - 1)] == Jit::hotThreshold) {
+			compileBlock(target);
+		}
 	}
-
-	void Core::decode(MemoryWord first, Core::CompareMoveToCondition& value) {
-		value.extract(first);
+	void Core::compileBlock(Address start) {
+		if (_jit->find(start)) {
+			return;
+		}
+		auto pc = getPC();
+		auto resumeAt = pc.getAddress();
+		auto end = start;
+		Address count = 0;
+		pc.setAddress(start);
+		_jit->beginBlock(_registers);
+		try {
+			while (count < Jit::maximumBlockLength) {
+				auto instruction = decode();
+				if (pc.getAddress() > end) {
+					// don't let a block wrap around the end of memory
+					break;
+				}
+				if (!_jit->translate(instruction)) {
+					break;
+				}
+				end = pc.getAddress();
+				++count;
+			}
+		} catch (Problem&) {
+			// leave it to the interpreter to report when it gets there
+		}
+		pc.setAddress(resumeAt);
+		if (count == 0) {
+			return;
+		}
+		auto block = _jit->endBlock(start, end, start - end, count);
+		if (!block) {
+			// out of space for native code, start over
+			flushCompiledBlocks();
+			return;
+		}
+		if (auto& entry = _decodeCache[start & (decodeCacheSize - 1)]; entry._valid && entry._address == start) {
+			entry._block = block;
+		}
 	}
-
-	void Core::decode(MemoryWord first, Core::CompareMoveFromCondition& value) {
-		value.extract(first);
+	void Core::invalidateCompiledBlocks(Address base, Address length) {
+		std::vector<Address> removed;
+		_jit->invalidate(base, length, removed);
+		for (auto start : removed) {
+			if (auto& entry = _decodeCache[start & (decodeCacheSize - 1)]; entry._address == start) {
+				entry._block = nullptr;
+			}
+			// compiling only happens when the count reaches the threshold,
+			// start counting over so the new code gets compiled once hot
+			_branchTargetCounts[start & (decodeCacheSize - 1)] = 0;
+		}
 	}
-
-	void Core::run() {
-		while (_keepExecuting) {
-			invoke(decode());
+	void Core::flushCompiledBlocks() noexcept {
+		if (_jit) {
+			_jit->flush();
+			for (Address i = 0; i < decodeCacheSize; ++i) {
+				_decodeCache[i]._block = nullptr;
+				_branchTargetCounts[i] = 0;
+			}
 		}
 	}
+	template<Address capacity>
+	void Core::runThreaded() {
+#if defined(__GNUC__)
+		// must be kept in the same order as OperationKind
+		static void* const handlers[] = {
+			&&DoCompareRegister,
+			&&DoCompareImmediate,
+			&&DoCompareMoveFromCondition,
+			&&DoCompareMoveToCondition,
+			&&DoArithmeticRegister,
+			&&DoArithmeticImmediate,
+			&&DoLogicalRegister,
+			&&DoLogicalImmediate,
+			&&DoShiftRegister,
+			&&DoShiftImmediate,
+			&&DoBranchRegister,
+			&&DoBranchImmediate,
+			&&DoMemoryLoad,
+			&&DoMemoryStore,
+			&&DoMemoryPush,
+			&&DoMemoryPop,
+			&&DoMove,
+			&&DoSet,
+			&&DoSwap,
+			&&DoReturn,
+			&&DoTerminate,
+			&&DoPutCharacter,
+			&&DoGetCharacter,
+			&&DoReadWord,
+			&&DoStringEquals,
+			&&DoStringCopy,
+			&&DoReadBuffer,
+			&&DoWriteBuffer,
+			&&DoBlockCopy,
+			&&DoBlockFill,
+			&&DoBlockCompare,
+			&&DoBlockSearch,
+			&&DoIllegalOpcode,
+			&&DoIllegalMisc,
+			&&DoFusedCompareBranch,
+			&&DoFusedSetMemory,
+		};
+		static_assert(sizeof(handlers) / sizeof(void*) == byte(OperationKind::Count), "Missing handler for an operation kind!");
+		const CachedInstruction* current = nullptr;
+		// every handler does its own dispatch so the host branch predictor
+		// gets a separate indirect jump per guest operation kind
+#define DispatchNext() \
+		if (!_keepExecuting) { \
+			return; \
+		} \
+		current = &fetch<capacity>(); \
+		goto *handlers[byte(current->_handler)]
+
+		DispatchNext();
+DoCompareRegister:
+		retire<capacity, OperationKind::CompareRegister>(current->_instruction);
+		DispatchNext();
+DoCompareImmediate:
+		retire<capacity, OperationKind::CompareImmediate>(current->_instruction);
+		DispatchNext();
+DoCompareMoveFromCondition:
+		retire<capacity, OperationKind::CompareMoveFromCondition>(current->_instruction);
+		DispatchNext();
+DoCompareMoveToCondition:
+		retire<capacity, OperationKind::CompareMoveToCondition>(current->_instruction);
+		DispatchNext();
+DoArithmeticRegister:
+		retire<capacity, OperationKind::ArithmeticRegister>(current->_instruction);
+		DispatchNext();
+DoArithmeticImmediate:
+		retire<capacity, OperationKind::ArithmeticImmediate>(current->_instruction);
+		DispatchNext();
+DoLogicalRegister:
+		retire<capacity, OperationKind::LogicalRegister>(current->_instruction);
+		DispatchNext();
+DoLogicalImmediate:
+		retire<capacity, OperationKind::LogicalImmediate>(current->_instruction);
+		DispatchNext();
+DoShiftRegister:
+		retire<capacity, OperationKind::ShiftRegister>(current->_instruction);
+		DispatchNext();
+DoShiftImmediate:
+		retire<capacity, OperationKind::ShiftImmediate>(current->_instruction);
+		DispatchNext();
+DoBranchRegister:
+		retire<capacity, OperationKind::BranchRegister>(current->_instruction);
+		DispatchNext();
+DoBranchImmediate:
+		retire<capacity, OperationKind::BranchImmediate>(current->_instruction);
+		DispatchNext();
+DoMemoryLoad:
+		retire<capacity, OperationKind::MemoryLoad>(current->_instruction);
+		DispatchNext();
+DoMemoryStore:
+		retire<capacity, OperationKind::MemoryStore>(current->_instruction);
+		DispatchNext();
+DoMemoryPush:
+		retire<capacity, OperationKind::MemoryPush>(current->_instruction);
+		DispatchNext();
+DoMemoryPop:
+		retire<capacity, OperationKind::MemoryPop>(current->_instruction);
+		DispatchNext();
+DoMove:
+		retire<capacity, OperationKind::Move>(current->_instruction);
+		DispatchNext();
+DoSet:
+		retire<capacity, OperationKind::Set>(current->_instruction);
+		DispatchNext();
+DoSwap:
+		retire<capacity, OperationKind::Swap>(current->_instruction);
+		DispatchNext();
+DoReturn:
+		retire<capacity, OperationKind::Return>(current->_instruction);
+		DispatchNext();
+DoTerminate:
+		retire<capacity, OperationKind::Terminate>(current->_instruction);
+		DispatchNext();
+DoPutCharacter:
+		retire<capacity, OperationKind::PutCharacter>(current->_instruction);
+		DispatchNext();
+DoGetCharacter:
+		retire<capacity, OperationKind::GetCharacter>(current->_instruction);
+		DispatchNext();
+DoReadWord:
+		retire<capacity, OperationKind::ReadWord>(current->_instruction);
+		DispatchNext();
+DoStringEquals:
+		retire<capacity, OperationKind::StringEquals>(current->_instruction);
+		DispatchNext();
+DoStringCopy:
+		retire<capacity, OperationKind::StringCopy>(current->_instruction);
+		DispatchNext();
+DoReadBuffer:
+		retire<capacity, OperationKind::ReadBuffer>(current->_instruction);
+		DispatchNext();
+DoWriteBuffer:
+		retire<capacity, OperationKind::WriteBuffer>(current->_instruction);
+		DispatchNext();
+DoBlockCopy:
+		retire<capacity, OperationKind::BlockCopy>(current->_instruction);
+		DispatchNext();
+DoBlockFill:
+		retire<capacity, OperationKind::BlockFill>(current->_instruction);
+		DispatchNext();
+DoBlockCompare:
+		retire<capacity, OperationKind::BlockCompare>(current->_instruction);
+		DispatchNext();
+DoBlockSearch:
+		retire<capacity, OperationKind::BlockSearch>(current->_instruction);
+		DispatchNext();
+DoIllegalOpcode:
+		retire<capacity, OperationKind::IllegalOpcode>(current->_instruction);
+		DispatchNext();
+DoIllegalMisc:
+		retire<capacity, OperationKind::IllegalMisc>(current->_instruction);
+		DispatchNext();
+DoFusedCompareBranch:
+		invokeFused<capacity>(OperationTag<OperationKind::FusedCompareBranch>(), *current);
+		DispatchNext();
+DoFusedSetMemory:
+		invokeFused<capacity>(OperationTag<OperationKind::FusedSetMemory>(), *current);
+		DispatchNext();
+#undef DispatchNext
+#else
+		// computed goto is a GNU extension, just use the standard engine otherwise
+		runStandard<capacity>();
+#endif
+	}
 	Address readRegisterValue(std::istream& in) {
 		if (in.eof() || in.bad()) {
 			throw Problem("Premature termination during memory word read!");
@@ -797,29 +1583,67 @@ namespace cisc0 {
 	void Core::install(std::istream& in) {
 		// read the 16 registers first
 		for (int i = 0; i < ArchitectureConstants::RegisterCount; ++i) {
-			_registers[i].setAddress(readRegisterValue(in));
+			_registers.set(i, readRegisterValue(in));
 		}
+		_memory.clear();
 		for (Address i = 0; i < _capacity; ++i) {
-			_memory[i] = readMemoryWord(in);
+			_memory.store(i, readMemoryWord(in));
+		}
+		flushDecodeCache();
+		flushCompiledBlocks();
+	}
+	void Core::install(const std::string& path) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		// the capacity followed by the registers, then the memory words
+		constexpr auto headerSize = sizeof(Address) * (1 + ArchitectureConstants::RegisterCount);
+		if (auto fd = open(path.c_str(), O_RDONLY); fd != -1) {
+			struct stat info;
+			auto length = headerSize + size_t(_capacity) * sizeof(MemoryWord);
+			// a short image is left to the stream reader to complain about
+			auto mapping = (fstat(fd, &info) == 0 && size_t(info.st_size) >= length) ?
+				mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) :
+				MAP_FAILED;
+			close(fd);
+			if (mapping != MAP_FAILED) {
+				auto image = static_cast<const byte*>(mapping);
+				for (int i = 0; i < ArchitectureConstants::RegisterCount; ++i) {
+					Address value;
+					std::memcpy(&value, image + sizeof(Address) * (i + 1), sizeof(Address));
+					_registers.set(i, value);
+				}
+				_memory.adopt(reinterpret_cast<MemoryWord*>(static_cast<byte*>(mapping) + headerSize), _capacity, mapping, length);
+				flushDecodeCache();
+				flushCompiledBlocks();
+				return;
+			}
 		}
+#endif
+		std::ifstream in(path.c_str(), std::ios::binary);
+		if (!in.is_open()) {
+			throw Problem("Could not open image for reading!");
+		}
+		// skip over the capacity
+		readRegisterValue(in);
+		install(in);
 	}
 	void Core::dump(std::ostream& out) {
 		writeAddress(out, _capacity);
 		for (int i = 0; i < ArchitectureConstants::RegisterCount; ++i) {
-			writeAddress(out, _registers[i].getAddress());
-		}
-
-		for (Address a = 0; a < _capacity; ++a) {
-			writeMemoryWord(out, _memory[a]);
+			writeAddress(out, _registers.get(i));
 		}
+		_memory.forEachPage(_capacity, [this, &out](const MemoryWord* page, Address base) {
+			auto count = (_capacity - base) < PagedMemory::pageSize ? (_capacity - base) : PagedMemory::pageSize;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			// pages are already laid out the way the image stores them
+			out.write(reinterpret_cast<const char*>(page), std::streamsize(count) * sizeof(MemoryWord));
+#else
+			for (Address a = 0; a < count; ++a) {
+				writeMemoryWord(out, page[a]);
+			}
+#endif
+		});
 	}
 
-	Register& Core::getValueRegister() noexcept {
-		return getRegister<Core::ArchitectureConstants::ValueRegister>();
-	}
-	Register& Core::getAddressRegister() noexcept {
-		return getRegister<Core::ArchitectureConstants::AddressRegister>();
-	}
     Address Core::loadAddress(Address addr) {
         auto lower = Address(loadWord(addr));
         auto upper = Address(loadWord(addr+1)) << 16;
@@ -839,6 +1663,165 @@ namespace cisc0 {
         storeWord(a, MemoryWord(v));
         storeWord(a+1, MemoryWord(v >> 16));
     }
+	Integer Core::readCharacter() {
+		if (_replayInput) {
+			return _replayInput->nextCharacter(_statistics.getInstructionCount());
+		}
+		if (!_input->buffered()) {
+			// anything the guest wrote should be visible before it waits
+			_output->flush();
+		}
+		auto c = Integer(_input->get());
+		if (_recordInput) {
+			_recordInput->character(_statistics.getInstructionCount(), c);
+		}
+		return c;
+	}
+	std::string Core::readWord() {
+		if (_replayInput) {
+			return _replayInput->nextWord(_statistics.getInstructionCount());
+		}
+		if (!_input->buffered()) {
+			_output->flush();
+		}
+		auto str = _input->getWord();
+		if (_recordInput) {
+			_recordInput->word(_statistics.getInstructionCount(), str);
+		}
+		return str;
+	}
+	void Core::checkBufferRange(Address base, Address count) const {
+		if (count > 0 && (base >= _capacity || count > _capacity - base)) {
+			throw Problem("Illegal address!");
+		}
+	}
+	void Core::fillMemory(Address base, const char* data, Address length) {
+		for (Address done = 0; done < length; ) {
+			auto addr = base + done;
+			auto offset = addr & PagedMemory::pageMask;
+			auto span = std::min(length - done, PagedMemory::pageSize - offset);
+			auto page = _memory.writablePage(addr) + offset;
+			for (Address i = 0; i < span; ++i) {
+				// same as a character read, never sign extended
+				page[i] = MemoryWord(static_cast<unsigned char>(data[done + i]));
+			}
+			done += span;
+		}
+		if (_trace) {
+			for (Address i = 0; i < length; ++i) {
+				_trace->noteStore(base + i, MemoryWord(static_cast<unsigned char>(data[i])));
+			}
+		}
+		invalidateRange(base, length);
+	}
+	void Core::invalidateRange(Address base, Address length) {
+		if (length == 0) {
+			return;
+		}
+		if (_decodeCache) {
+			if (length + 5 <= decodeCacheSize) {
+				// same as invalidateDecodeCache on each word but every start
+				// address which could reach into the range is looked at once
+				for (Address offset = 0; offset < length + 5; ++offset) {
+					auto start = (base + offset) & (_capacity - 1);
+					auto& entry = _decodeCache[start & (decodeCacheSize - 1)];
+					if (entry._valid && entry._address == start && offset + 1 < length + entry.getLength()) {
+						entry._valid = false;
+					}
+				}
+			} else {
+				// more start addresses than entries, check what each entry holds instead
+				for (Address i = 0; i < decodeCacheSize; ++i) {
+					auto& entry = _decodeCache[i];
+					auto offset = (entry._address - base) & (_capacity - 1);
+					if (entry._valid && DoubleAddress(offset) + 1 < DoubleAddress(length) + entry.getLength()) {
+						entry._valid = false;
+					}
+				}
+			}
+		}
+		if (_jit && _jit->covers(base, length)) {
+			invalidateCompiledBlocks(base, length);
+		}
+	}
+	void Core::noteStores(Address base, Address length) {
+		if (_trace) {
+			for (Address i = 0; i < length; ++i) {
+				_trace->noteStore(base + i, _memory.load(base + i));
+			}
+		}
+		invalidateRange(base, length);
+	}
+	void Core::copyBlock(Address dest, Address src, Address count) {
+		checkBufferRange(src, count);
+		checkBufferRange(dest, count);
+		_memory.move(dest, src, count);
+		noteStores(dest, count);
+	}
+	void Core::fillBlock(Address dest, MemoryWord value, Address count) {
+		checkBufferRange(dest, count);
+		_memory.fill(dest, value, count);
+		noteStores(dest, count);
+	}
+	bool Core::compareBlock(Address a, Address b, Address count) {
+		checkBufferRange(a, count);
+		checkBufferRange(b, count);
+		return _memory.equal(a, b, count);
+	}
+	Address Core::searchBlock(Address base, MemoryWord value, Address count) {
+		checkBufferRange(base, count);
+		return _memory.find(base, value, count);
+	}
+	Address Core::readBuffer(Address base, Address count) {
+		checkBufferRange(base, count);
+		if (_replayInput) {
+			auto data = _replayInput->nextBuffer(_statistics.getInstructionCount(), count);
+			fillMemory(base, data.data(), Address(data.size()));
+			return Address(data.size());
+		}
+		if (!_input->buffered()) {
+			_output->flush();
+		}
+		char chunk[PagedMemory::pageSize];
+		std::string recorded;
+		Address total = 0;
+		while (total < count) {
+			// like a host read only the first chunk is waited for
+			if (total > 0 && !_input->buffered()) {
+				break;
+			}
+			auto addr = base + total;
+			auto length = Address(_input->read(chunk, std::min(count - total, PagedMemory::pageSize - (addr & PagedMemory::pageMask))));
+			if (length == 0) {
+				break;
+			}
+			fillMemory(addr, chunk, length);
+			if (_recordInput) {
+				recorded.append(chunk, length);
+			}
+			total += length;
+		}
+		if (_recordInput) {
+			_recordInput->buffer(_statistics.getInstructionCount(), recorded);
+		}
+		return total;
+	}
+	Address Core::writeBuffer(Address base, Address count) {
+		checkBufferRange(base, count);
+		char chunk[PagedMemory::pageSize];
+		for (Address done = 0; done < count; ) {
+			auto addr = base + done;
+			auto offset = addr & PagedMemory::pageMask;
+			auto span = std::min(count - done, PagedMemory::pageSize - offset);
+			auto page = _memory.readablePage(addr) + offset;
+			for (Address i = 0; i < span; ++i) {
+				chunk[i] = char(page[i]);
+			}
+			_output->write(chunk, span);
+			done += span;
+		}
+		return count;
+	}
     void Core::storeString(Address base, Address count, const std::string& value) {
         storeAddress(base, count);
         auto offset = base + 2;
@@ -846,59 +1829,222 @@ namespace cisc0 {
             storeWord(x + offset, MemoryWord(value[x]));
         }
     }
-
-    void Core::decode(MemoryWord first, StringCopy& value) {
-        value.extract(first);
-    }
-
-    void Core::decode(MemoryWord first, StringEquals& value) {
-        value.extract(first);
-    }
-
-    void Core::invoke(const StringCopy& value) {
-        auto& src = getSource(value);
-        auto& dest = getDestination(value);
-        auto sourceStr = loadString(src.getAddress());
-        storeString(dest.getAddress(), Address(sourceStr.size()), sourceStr);
-    }
-
-    void Core::invoke(const StringEquals& value) {
-        auto& src = getSource(value);
-        auto& dest = getDestination(value);
-        auto str0 = loadString(src.getAddress());
-        auto str1 = loadString(dest.getAddress());
-        _conditionRegister = (str0 == str1);
-    }
-
-    void Core::decode(MemoryWord first, Core::GetCharacter& value) { 
-        value.extract(first); 
-    }
-
-    void Core::decode(MemoryWord first, Core::PutCharacter& value) { 
-        value.extract(first); 
-    }
-
-    void Core::invoke(const Core::PutCharacter& value) {
-        std::cout.put(char(getDestination(value).getInteger()));
-    }
-
-    void Core::invoke(const Core::GetCharacter& value) {
-        auto& dest = getDestination(value);
-        dest.setInteger(Integer(std::cin.get()));
-    }
-
-    void Core::invoke(const Core::ReadWord& value) {
-        auto& src = getSource(value);
-        auto& dest = getDestination(value);
-        std::string str;
-        std::cin >> str;
-        auto length = str.size();
-        auto size = src.getAddress();
-        auto cap = length > size ? size : length ;
-        storeString(dest.getAddress(), cap, str);
-    }
-    void Core::decode(MemoryWord first, Core::ReadWord& value) {
-        value.extract(first);
-    }
+	void Core::copyString(Address dest, Address src) {
+		if (!inCapacity(src, 2)) {
+			// a device or an illegal address, let the word at a time path sort it out
+			auto str = loadString(src);
+			storeString(dest, Address(str.size()), str);
+			return;
+		}
+		auto size = loadAddress(src);
+		auto length = DoubleAddress(size) + 2;
+		if (!inCapacity(src, length) || !inCapacity(dest, length)) {
+			auto str = loadString(src);
+			storeString(dest, Address(str.size()), str);
+			return;
+		}
+		auto from = src + 2;
+		auto to = dest + 2;
+		// every character is read before any write in loadString, move
+		// keeps that true for overlapping strings
+		_memory.move(to, from, size);
+		for (Address done = 0; done < size; ) {
+			auto offset = (to + done) & PagedMemory::pageMask;
+			auto span = std::min(size - done, PagedMemory::pageSize - offset);
+			auto page = _memory.writablePage(to + done) + offset;
+			for (Address i = 0; i < span; ++i) {
+				// truncated to a char and sign extended back, as storeString does
+				page[i] = MemoryWord(char(page[i]));
+			}
+			done += span;
+		}
+		// the length never overlaps the characters written after it
+		_memory.store(dest, MemoryWord(size));
+		_memory.store(dest + 1, MemoryWord(size >> 16));
+		noteStores(dest, Address(length));
+	}
+	bool Core::compareStrings(Address a, Address b) {
+		if (inCapacity(a, 2) && inCapacity(b, 2)) {
+			auto sizeA = loadAddress(a);
+			auto sizeB = loadAddress(b);
+			// both strings are loaded in full before comparing, so a short
+			// cut is only safe once neither can run into a bad address
+			if (inCapacity(a, DoubleAddress(sizeA) + 2) && inCapacity(b, DoubleAddress(sizeB) + 2)) {
+				if (sizeA != sizeB) {
+					return false;
+				}
+				auto left = a + 2;
+				auto right = b + 2;
+				for (Address done = 0; done < sizeA; ) {
+					auto offsetLeft = (left + done) & PagedMemory::pageMask;
+					auto offsetRight = (right + done) & PagedMemory::pageMask;
+					auto span = std::min({sizeA - done, PagedMemory::pageSize - offsetLeft, PagedMemory::pageSize - offsetRight});
+					auto pageLeft = _memory.readablePage(left + done) + offsetLeft;
+					auto pageRight = _memory.readablePage(right + done) + offsetRight;
+					// only the char each word turns into is compared, no early
+					// out within a span keeps the loop easy to vectorize
+					MemoryWord difference = 0;
+					for (Address i = 0; i < span; ++i) {
+						difference |= pageLeft[i] ^ pageRight[i];
+					}
+					if ((difference & 0xFF) != 0) {
+						return false;
+					}
+					done += span;
+				}
+				return true;
+			}
+		}
+		return loadString(a) == loadString(b);
+	}
+	const char* Core::getKindName(OperationKind kind) noexcept {
+		static constexpr const char* names[] = {
+			"CompareRegister", "CompareImmediate", "CompareMoveFromCondition", "CompareMoveToCondition",
+			"ArithmeticRegister", "ArithmeticImmediate", "LogicalRegister", "LogicalImmediate",
+			"ShiftRegister", "ShiftImmediate", "BranchRegister", "BranchImmediate",
+			"MemoryLoad", "MemoryStore", "MemoryPush", "MemoryPop",
+			"Move", "Set", "Swap", "Return", "Terminate",
+			"PutCharacter", "GetCharacter", "ReadWord", "StringEquals", "StringCopy",
+			"ReadBuffer", "WriteBuffer", "BlockCopy", "BlockFill", "BlockCompare", "BlockSearch",
+			"IllegalOpcode", "IllegalMisc", "FusedCompareBranch", "FusedSetMemory",
+		};
+		static_assert(sizeof(names) / sizeof(const char*) == byte(OperationKind::Count), "Missing name for an operation kind!");
+		return byte(kind) < byte(OperationKind::Count) ? names[byte(kind)] : "Unknown";
+	}
+	const char* Core::getOperationCodeName(OperationCode code) noexcept {
+		static constexpr const char* names[] = {
+			"Memory", "Arithmetic", "Shift", "Logical", "Compare",
+			"Branch", "Move", "Set", "Swap", "Misc", "Block",
+		};
+		return byte(code) < (sizeof(names) / sizeof(const char*)) ? names[byte(code)] : "Illegal";
+	}
+	const char* Core::getVariantName(OperationKind kind, byte variant) noexcept {
+		static constexpr const char* arithmetic[maximumVariantCount] = { "Add", "Sub", "Mul", "Div", "Rem", "Min", "Max", "Undefined" };
+		static constexpr const char* logical[maximumVariantCount] = { "And", "Or", "Xor", "Nand", "Not", "Illegal5", "Illegal6", "Illegal7" };
+		static constexpr const char* compare[maximumVariantCount] = { "Equals", "NotEquals", "LessThan", "GreaterThan", "LessThanOrEqualTo", "GreaterThanOrEqualTo" };
+		static constexpr const char* shift[maximumVariantCount] = { "Right", "Left" };
+		static constexpr const char* branch[maximumVariantCount] = { "Jump", "Call", "ConditionalJump", "ConditionalCall" };
+		static constexpr const char* memory[maximumVariantCount] = { "NoMask", "PartialMask", "FullMask" };
+		if (variant >= maximumVariantCount) {
+			return nullptr;
+		}
+		using K = OperationKind;
+		switch (kind) {
+			case K::ArithmeticRegister:
+			case K::ArithmeticImmediate:
+				return arithmetic[variant];
+			case K::LogicalRegister:
+			case K::LogicalImmediate:
+				return logical[variant];
+			case K::CompareRegister:
+			case K::CompareImmediate:
+				return compare[variant];
+			case K::ShiftRegister:
+			case K::ShiftImmediate:
+				return shift[variant];
+			case K::BranchRegister:
+			case K::BranchImmediate:
+				return branch[variant];
+			case K::MemoryLoad:
+			case K::MemoryStore:
+			case K::MemoryPush:
+			case K::MemoryPop:
+				return memory[variant];
+			default:
+				return nullptr;
+		}
+	}
+	void Core::printStatistics(std::ostream& out) const {
+		auto& stats = _statistics;
+		out << "instructions: " << stats.getInstructionCount() << std::endl;
+		out << "dispatches: " << stats._dispatches << std::endl;
+		out << "fused compare and branch: " << stats._fusedCompareBranches << std::endl;
+		out << "fused set and memory: " << stats._fusedSetMemories << std::endl;
+		out << "compiled blocks: " << stats._compiledBlocks << std::endl;
+#if CISC0_COUNTERS
+		uint64_t opcodes[16] = { 0 };
+		for (byte k = 0; k < byte(OperationKind::Count); ++k) {
+			opcodes[byte(getOperationCode(OperationKind(k)))] += stats._kinds[k];
+		}
+		out << "retired by opcode:" << std::endl;
+		for (byte code = 0; code <= byte(OperationCode::Block); ++code) {
+			out << "\t" << getOperationCodeName(OperationCode(code)) << ": " << opcodes[code] << std::endl;
+		}
+		out << "retired by kind:" << std::endl;
+		for (byte k = 0; k < byte(OperationKind::Count); ++k) {
+			if (stats._kinds[k] == 0) {
+				continue;
+			}
+			out << "\t" << getKindName(OperationKind(k)) << ": " << stats._kinds[k];
+			if (countersEnabled && CISC0_COUNTER_TIMING) {
+				out << " (" << stats._nanoseconds[k] << "ns)";
+			}
+			out << std::endl;
+			for (byte v = 0; v < maximumVariantCount; ++v) {
+				if (auto name = getVariantName(OperationKind(k), v); name && stats._variants[k][v] != 0) {
+					out << "\t\t" << name << ": " << stats._variants[k][v] << std::endl;
+				}
+			}
+		}
+		out << "branches taken: " << stats._branchesTaken << std::endl;
+		out << "branches not taken: " << stats._branchesNotTaken << std::endl;
+		out << "calls: " << stats._calls << std::endl;
+		out << "returns: " << stats._kinds[byte(OperationKind::Return)] << std::endl;
+#endif
+	}
+	void Core::writeStatistics(std::ostream& out) const {
+		auto& stats = _statistics;
+		out << "{" << std::endl;
+		out << "\t\"instructions\": " << stats.getInstructionCount() << "," << std::endl;
+		out << "\t\"dispatches\": " << stats._dispatches << "," << std::endl;
+		out << "\t\"fused_compare_branches\": " << stats._fusedCompareBranches << "," << std::endl;
+		out << "\t\"fused_set_memories\": " << stats._fusedSetMemories << "," << std::endl;
+		out << "\t\"compiled_blocks\": " << stats._compiledBlocks;
+#if CISC0_COUNTERS
+		out << "," << std::endl;
+		uint64_t opcodes[16] = { 0 };
+		for (byte k = 0; k < byte(OperationKind::Count); ++k) {
+			opcodes[byte(getOperationCode(OperationKind(k)))] += stats._kinds[k];
+		}
+		out << "\t\"opcodes\": {" << std::endl;
+		for (byte code = 0; code <= byte(OperationCode::Block); ++code) {
+			out << "\t\t\"" << getOperationCodeName(OperationCode(code)) << "\": " << opcodes[code];
+			out << (code < byte(OperationCode::Block) ? "," : "") << std::endl;
+		}
+		out << "\t}," << std::endl;
+		out << "\t\"kinds\": {" << std::endl;
+		for (byte k = 0; k < byte(OperationKind::Count); ++k) {
+			out << "\t\t\"" << getKindName(OperationKind(k)) << "\": { \"retired\": " << stats._kinds[k];
+			if (countersEnabled && CISC0_COUNTER_TIMING) {
+				out << ", \"nanoseconds\": " << stats._nanoseconds[k];
+			}
+			out << ", \"variants\": {";
+			bool first = true;
+			for (byte v = 0; v < maximumVariantCount; ++v) {
+				if (auto name = getVariantName(OperationKind(k), v); name) {
+					out << (first ? " " : ", ") << "\"" << name << "\": " << stats._variants[k][v];
+					first = false;
+				}
+			}
+			out << (first ? "" : " ") << "} }" << (k + 1 < byte(OperationKind::Count) ? "," : "") << std::endl;
+		}
+		out << "\t}," << std::endl;
+		out << "\t\"branches\": { \"taken\": " << stats._branchesTaken << ", \"not_taken\": " << stats._branchesNotTaken;
+		out << ", \"calls\": " << stats._calls << ", \"returns\": " << stats._kinds[byte(OperationKind::Return)] << " }";
+#endif
+		out << std::endl << "}" << std::endl;
+	}
+	// used outside of this file, always on the capacity known at run time
+	template void Core::storeWord<Core::dynamicCapacity>(Address, MemoryWord);
+	template MemoryWord Core::nextWord<Core::dynamicCapacity>();
+	template Address Core::popSubroutineAddress<Core::dynamicCapacity>() noexcept;
+	template MemoryWord Core::popSubroutineWord<Core::dynamicCapacity>() noexcept;
+	template MemoryWord Core::popParameterWord<Core::dynamicCapacity>() noexcept;
+	template Address Core::popParameterAddress<Core::dynamicCapacity>() noexcept;
+	template void Core::pushParameterWord<Core::dynamicCapacity>(MemoryWord) noexcept;
+	template void Core::pushParameterAddress<Core::dynamicCapacity>(Address) noexcept;
+	template void Core::pushSubroutineWord<Core::dynamicCapacity>(MemoryWord) noexcept;
+	template void Core::pushSubroutineAddress<Core::dynamicCapacity>(Address) noexcept;
+	template Core::Instruction Core::decode<Core::dynamicCapacity>();
+	template void Core::execute<Core::dynamicCapacity>(const Instruction&);
 } // end namespace cisc0
-
@@ -32,11 +32,28 @@
 #include <iostream>
 #include <typeinfo>
 #include <cstdint>
-#include <variant>
 #include <memory>
+#include <type_traits>
+#include <vector>
 #include "Problem.h"
 
+#ifndef CISC0_COUNTERS
+/// count retired instructions by kind, variant, and branch outcome
+#define CISC0_COUNTERS 0
+#endif
+#ifndef CISC0_COUNTER_TIMING
+/// also time each instruction kind, only meaningful with CISC0_COUNTERS
+#define CISC0_COUNTER_TIMING 0
+#endif
+
 namespace cisc0 {
+	class Jit;
+	class Profiler;
+	class TraceWriter;
+	class InputLog;
+	class InputChannel;
+	class OutputChannel;
+	struct CompiledBlock;
 	using Address = uint32_t;
 	using Integer = int32_t;
 	using byte = uint8_t;
@@ -61,36 +78,257 @@ namespace cisc0 {
 		auto upper = Address(make(higher, highest)) << 16;
 		return low | upper;
 	}
-	class Register {
+	/**
+	 * The sixteen registers of a core stored as plain values, one cache
+	 * line in all. Only the upper registers (address, call stack, stack,
+	 * and instruction pointer) are ever masked, whether a register is
+	 * masked is decided by its index so writing to any other register is
+	 * a single store.
+	 */
+	class RegisterFile {
+		public:
+			static constexpr RegisterIndex count = 16;
+			/// every register from here up is masked
+			static constexpr RegisterIndex firstMasked = 12;
+			static constexpr bool isMasked(RegisterIndex index) noexcept { return index >= firstMasked; }
+		public:
+			RegisterFile() noexcept;
+			Address get(RegisterIndex index) const noexcept { return _values[index]; }
+			void set(RegisterIndex index, Address value) noexcept {
+				_values[index] = isMasked(index) ? (value & _masks[index - firstMasked]) : value;
+			}
+			template<RegisterIndex index>
+			void set(Address value) noexcept {
+				static_assert(index < count, "Illegal register index!");
+				if constexpr (isMasked(index)) {
+					_values[index] = value & _masks[index - firstMasked];
+				} else {
+					_values[index] = value;
+				}
+			}
+			Address getMask(RegisterIndex index) const noexcept {
+				return isMasked(index) ? _masks[index - firstMasked] : 0xFFFFFFFF;
+			}
+			/// @param index has to be one of the masked registers
+			void setMask(RegisterIndex index, Address mask) noexcept;
+			/// store a value the caller has already masked
+			template<RegisterIndex index>
+			void assign(Address value) noexcept {
+				static_assert(index < count, "Illegal register index!");
+				_values[index] = value;
+			}
+			/// the raw values, what generated code works on
+			Address* data() noexcept { return _values; }
+		private:
+			alignas(64) Address _values[count];
+			Address _masks[count - firstMasked];
+	};
+	/// marks a RegisterHandle whose index is only known at run time
+	constexpr int dynamicRegisterIndex = -1;
+	/**
+	 * A cheap to copy view of a single register in a RegisterFile. When
+	 * the index is known at compile time the masking is resolved at
+	 * compile time too.
+	 */
+	template<int Index>
+	class RegisterHandle {
 		public:
-			Register(Address value = 0, Address mask = 0xFFFFFFFF) : _address(value), _mask(mask) {
-				maskContents();
+			RegisterHandle(RegisterFile& file, RegisterIndex index = RegisterIndex(Index)) noexcept : _file(file), _index(index) { }
+			Address getAddress() const noexcept { return _file.get(index()); }
+			Integer getInteger() const noexcept { return Integer(getAddress()); }
+			bool getTruth() const noexcept { return getAddress() != 0; }
+			void setAddress(Address value) noexcept {
+				if constexpr (Index == dynamicRegisterIndex) {
+					_file.set(_index, value);
+				} else {
+					_file.template set<RegisterIndex(Index)>(value);
+				}
 			}
-			Register(Integer value, Address mask = 0xFFFFFFFF) : _integer(value), _mask(mask) {
-				maskContents();
+			void setInteger(Integer value) noexcept { setAddress(Address(value)); }
+			void increment(Address incrementValue = 1) noexcept { setAddress(getAddress() + incrementValue); }
+			void decrement(Address decrementValue = 1) noexcept { setAddress(getAddress() - decrementValue); }
+			void setLowerHalf(MemoryWord value) noexcept { setAddress((getAddress() & 0xFFFF0000) | Address(value)); }
+			void setUpperHalf(MemoryWord value) noexcept { setAddress((getAddress() & 0x0000FFFF) | (Address(value) << 16)); }
+			MemoryWord getUpperHalf() const noexcept { return MemoryWord((getAddress() & 0xFFFF0000) >> 16); }
+			MemoryWord getLowerHalf() const noexcept { return MemoryWord((getAddress() & 0x0000FFFF)); }
+			Address getMask() const noexcept { return _file.getMask(index()); }
+		private:
+			constexpr RegisterIndex index() const noexcept {
+				if constexpr (Index == dynamicRegisterIndex) {
+					return _index;
+				} else {
+					return RegisterIndex(Index);
+				}
 			}
-			Register(const Register& other) : _address(other._address), _mask(other._mask) { }
-			Address getAddress() const noexcept { return _address; }
-			Integer getInteger() const noexcept { return _integer; }
-			bool getTruth() const noexcept { return _address != 0; }
-			void setAddress(Address value) noexcept;
-			void setInteger(Integer value) noexcept;
-			void increment(Address incrementValue = 1) noexcept;
-			void decrement(Address decrementValue = 1) noexcept;
-			void setLowerHalf(MemoryWord value) noexcept;
-			void setUpperHalf(MemoryWord value) noexcept;
-			MemoryWord getUpperHalf() const noexcept { return MemoryWord((_address & 0xFFFF0000) >> 16); }
-			MemoryWord getLowerHalf() const noexcept { return MemoryWord((_address & 0x0000FFFF)); }
-			void setMask(Address mask) noexcept;
-			Address getMask() const noexcept { return _mask; }
 		private:
-			void maskContents() noexcept;
+			RegisterFile& _file;
+			RegisterIndex _index;
+	};
+	/// a register picked at run time, such as an instruction operand
+	using Register = RegisterHandle<dynamicRegisterIndex>;
+	/**
+	 * Guest memory split up along the lines of doc/cisc0/memory_map. The
+	 * upper byte of an address selects one of the 24-bit regions and the
+	 * rest is broken up into pages. Pages are only allocated once something
+	 * other than zero is written to them, untouched pages read as zero.
+	 * Pages can be shared copy on write with a fork of the memory.
+	 */
+	class PagedMemory {
+		public:
+			static constexpr byte regionShift = 24;
+			static constexpr Address regionCount = 256;
+			static constexpr byte pageShift = 12;
+			/// number of words in a single page
+			static constexpr Address pageSize = 1 << pageShift;
+			static constexpr Address pageMask = pageSize - 1;
+			static constexpr Address pagesPerRegion = (1 << regionShift) >> pageShift;
+			using Page = MemoryWord*;
+		public:
+			PagedMemory() noexcept;
+			~PagedMemory();
+			PagedMemory(const PagedMemory&) = delete;
+			PagedMemory& operator=(const PagedMemory&) = delete;
+			MemoryWord load(Address addr) const noexcept {
+				return _regions[addr >> regionShift]->_read[pageIndex(addr)][addr & pageMask];
+			}
+			void store(Address addr, MemoryWord value) {
+				auto page = _regions[addr >> regionShift]->_write[pageIndex(addr)];
+				if (!page) {
+					if (value == 0 && load(addr) == 0) {
+						// nothing would change
+						return;
+					}
+					page = makeWritable(addr);
+				}
+				page[addr & pageMask] = value;
+			}
+			/// the page holding addr, for bulk reads
+			const MemoryWord* readablePage(Address addr) const noexcept {
+				return _regions[addr >> regionShift]->_read[pageIndex(addr)];
+			}
+			/// the page holding addr, owned by this memory alone, for bulk writes
+			MemoryWord* writablePage(Address addr) {
+				auto page = _regions[addr >> regionShift]->_write[pageIndex(addr)];
+				return page ? page : makeWritable(addr);
+			}
+			/// copy count words starting at addr out to words, spanning pages as need be
+			void read(Address addr, MemoryWord* words, Address count) const noexcept;
+			/// copy count words in starting at addr, spanning pages as need be
+			void write(Address addr, const MemoryWord* words, Address count);
+			/// copy count words from one address to another, the two ranges may overlap
+			void move(Address to, Address from, Address count);
+			void fill(Address addr, MemoryWord value, Address count);
+			bool equal(Address a, Address b, Address count) const noexcept;
+			/// @return how many words come before the first one equal to value, count if there is none
+			Address find(Address addr, MemoryWord value, Address count) const noexcept;
+			/**
+			 * Back the first count words with the given words, which have to
+			 * stay alive and writable for as long as this memory does
+			 * @param mapping released with munmap once no memory uses it
+			 */
+			void adopt(MemoryWord* words, Address count, void* mapping, size_t mappingLength);
+			/**
+			 * Share every page with the given memory, whatever was in this
+			 * memory is thrown away. Both sides copy a shared page the
+			 * first time they write to it. Not safe to call while other
+			 * threads are forking from or running on other.
+			 */
+			void fork(PagedMemory& other);
+			/**
+			 * Throw away the contents and go back to all zeroes
+			 */
+			void clear() noexcept;
+			/**
+			 * Throw away the contents and back the first count words with
+			 * one flat reservation spanning every 32-bit address. Only the
+			 * first count words are usable, touching any other word of the
+			 * reservation faults. Pages which are shared with a fork are
+			 * not allowed while reserved, so forking from a reserved
+			 * memory copies it and forking into one releases it.
+			 */
+			void reserve(Address count);
+			/// go back to allocating pages on demand, the contents are thrown away
+			void release() noexcept;
+			/// the flat reservation, null unless reserved
+			MemoryWord* getReservation() const noexcept { return _flat; }
+			/// true if the given host address is part of the reservation
+			bool inReservation(const void* addr) const noexcept {
+				return _reservation && addr >= _reservation && addr < static_cast<const byte*>(_reservation) + _reservationLength;
+			}
+			/**
+			 * Call fn(page, address of the first word) for each page up to
+			 * count words, untouched pages are handed out as the zero page
+			 */
+			template<typename F>
+			void forEachPage(Address count, F fn) const {
+				for (DoubleAddress base = 0; base < count; base += pageSize) {
+					auto addr = Address(base);
+					fn(const_cast<const MemoryWord*>(_regions[addr >> regionShift]->_read[pageIndex(addr)]), addr);
+				}
+			}
 		private:
-			union {
-				Address _address;
-				Integer _integer;
+			struct Region {
+				/// what to read from, the zero page if untouched
+				Page _read[pagesPerRegion];
+				/// what to write to, null unless the page is owned by this memory alone
+				Page _write[pagesPerRegion];
+				/// keeps each page alive while any memory refers to it
+				std::shared_ptr<MemoryWord[]> _owners[pagesPerRegion];
 			};
-			Address _mask;
+			static constexpr Address pageIndex(Address addr) noexcept {
+				return (addr >> pageShift) & (pagesPerRegion - 1);
+			}
+			static Page zeroPage() noexcept;
+			static Region* zeroRegion() noexcept;
+			/// the region containing addr, allocated if need be
+			Region& writableRegion(Address addr);
+			/// allocate or copy the page holding addr so it is owned by this memory alone
+			Page makeWritable(Address addr);
+			/// point the page tables at the reserved words
+			void mapReservation();
+		private:
+			Region* _regions[regionCount];
+			std::unique_ptr<Region> _ownedRegions[regionCount];
+			void* _reservation = nullptr;
+			size_t _reservationLength = 0;
+			/// bytes at the start of the reservation which are readable and writable
+			size_t _committedLength = 0;
+			MemoryWord* _flat = nullptr;
+			Address _flatCount = 0;
+	};
+	/**
+	 * Something other than RAM which answers loads and stores, such as the
+	 * ROM and MMIO pages of doc/cisc0/memory_map. Devices see the full
+	 * address so one device can sit behind several pages.
+	 */
+	class Device {
+		public:
+			virtual ~Device() = default;
+			virtual MemoryWord load(Address addr) = 0;
+			virtual void store(Address addr, MemoryWord value) = 0;
+	};
+	/**
+	 * Which device, if any, answers for each 24-bit region of the memory
+	 * map, looked up by the upper byte of the address
+	 */
+	class DeviceBus {
+		public:
+			Device* lookup(Address addr) const noexcept { return _pages[addr >> PagedMemory::regionShift]; }
+			bool empty() const noexcept {
+				for (auto page : _pages) {
+					if (page) {
+						return false;
+					}
+				}
+				return true;
+			}
+			void attach(byte page, std::shared_ptr<Device> device) noexcept {
+				_pages[page] = device.get();
+				_owners[page] = std::move(device);
+			}
+		private:
+			Device* _pages[PagedMemory::regionCount] = { nullptr };
+			std::shared_ptr<Device> _owners[PagedMemory::regionCount];
 	};
 	class Core {
 		public:
@@ -125,13 +363,7 @@ namespace cisc0 {
 				/// used by load/store routines to describe the source or destination of the operation
 				ValueRegister = R11,
 			};
-			struct Extractable {
-				public:
-					Extractable() = default;
-					~Extractable() = default;
-					virtual void extract(MemoryWord a, MemoryWord b = 0, MemoryWord c = 0) noexcept = 0;
-
-			};
+			static_assert(RegisterFile::isMasked(AddressRegister) && RegisterFile::isMasked(CallStackPointer) && RegisterFile::isMasked(StackPointer) && RegisterFile::isMasked(InstructionPointer) && !RegisterFile::isMasked(ValueRegister), "Only the address registers are masked!");
 			enum class OperationCode : byte { 
 				Memory, 
 				Arithmetic, 
@@ -143,140 +375,8 @@ namespace cisc0 {
 				Set, 
 				Swap, 
 				Misc, 
+				Block,
 			};
-			struct HasBitmask {
-				public:
-					HasBitmask() : _mask(0) { }
-					Bitmask getBitmask() const noexcept { return _mask; }
-					void setBitmask(Bitmask mask) noexcept { _mask = mask & 0x0F; }
-					void extractBitmask(MemoryWord word) noexcept { setBitmask(Bitmask((word & 0x0F00) >> 8)); }
-					Address getExpandedBitmask() const noexcept {
-						switch (_mask) {
-							case 0b0000: 
-								return 0x00000000;
-							case 0b0001: 
-								return 0x000000FF;
-							case 0b0010:
-								return 0x0000FF00;
-							case 0b0011:
-								return 0x0000FFFF;
-							case 0b0100:
-								return 0x00FF0000;
-							case 0b0101:
-								return 0x00FF00FF;
-							case 0b0110:
-								return 0x00FFFF00;
-							case 0b0111:
-								return 0x00FFFFFF;
-							case 0b1000:
-								return 0xFF000000;
-							case 0b1001:
-								return 0xFF0000FF;
-							case 0b1010:
-								return 0xFF00FF00;
-							case 0b1011:
-								return 0xFF00FFFF;
-							case 0b1100:
-								return 0xFFFF0000;
-							case 0b1101:
-								return 0xFFFF00FF;
-							case 0b1110:
-								return 0xFFFFFF00;
-							case 0b1111:
-								return 0xFFFFFFFF;
-							default:
-								throw Problem("Bad Index, terminating immediately!");
-						}
-					}
-					MemoryWord getLowerMask() const noexcept {
-						return MemoryWord(getExpandedBitmask() & 0x0000FFFF);
-					}
-					MemoryWord getUpperMask() const noexcept {
-						return MemoryWord((getExpandedBitmask() & 0xFFFF0000) >> 16);
-					}
-				private:
-					Bitmask _mask;
-			};
-			struct HasDestination {
-				public:
-					HasDestination() : _dest(0) { }
-					RegisterIndex getDestination() const noexcept { return _dest; }
-					void setDestination(RegisterIndex dest) noexcept { _dest = dest & 0x0F; }
-					void extractDestination(MemoryWord word) noexcept { setDestination(RegisterIndex((word & 0xF000) >> 12)); }
-				private:
-					RegisterIndex _dest;
-			};
-			struct HasSource {
-				public:
-					HasSource() : _src(0) { }
-					RegisterIndex getSource() const noexcept { return _src; }
-					void setSource(RegisterIndex src) noexcept { _src = src & 0x0F; }
-					void extractSource(MemoryWord word) noexcept { setSource(RegisterIndex((word & 0x0F00) >> 8)); }
-				private:
-					RegisterIndex _src;
-			};
-
-			struct HasImmediateValue {
-				public:
-					HasImmediateValue() : _value(0) { }
-					Address getImmediate() const noexcept { return _value; }
-					virtual void setImmediate(Address immediate) noexcept  { _value = immediate; }
-					void extractImmediate(MemoryWord lower, MemoryWord upper) noexcept {
-						auto up = Address(upper) << 16;
-						auto bot = Address(lower);
-						setImmediate(up | bot);
-					}
-				private:
-					Address _value;
-			};
-			struct HasMaskableImmediateValue : public Extractable, public HasBitmask, public HasImmediateValue {
-				public:
-					using Parent0 = HasBitmask;
-					using Parent1 = HasImmediateValue;
-				public:
-					HasMaskableImmediateValue() { };
-					virtual void setImmediate(Address immediate) noexcept override {
-						Parent1::setImmediate(immediate & getExpandedBitmask());
-					}
-
-					virtual void extract(MemoryWord a, MemoryWord b = 0, MemoryWord c = 0) noexcept override {
-						extractBitmask(a);
-						extractImmediate(b, c);
-					}
-
-			};
-			template<typename T>
-			static constexpr T extractStyle(MemoryWord value, MemoryWord mask = 0b00000000'11100000, byte shift = 5) {
-				return T((value & mask) >> shift);
-			}
-			template<typename S, MemoryWord mask, byte shift>
-			struct HasStyle {
-					static_assert(std::is_enum_v<S>, "HasStyle must be provided with an enum!");
-				public:
-					using Style = S;
-					HasStyle() : _value(static_cast<S>(0)) { }
-					Style getStyle() const noexcept { return _value; }
-					void setStyle(Style s) noexcept { _value = s; }
-					void extractStyle(MemoryWord value) noexcept { setStyle(static_cast<Style>((value & mask) >> shift)); }
-				private:
-					Style _value;
-			};
-
-			template<MemoryWord mask, byte shift>
-			struct HasMemoryOffset {
-				public:
-					HasMemoryOffset() : _value(0) { }
-					byte getMemoryOffset() const noexcept { return _value; }
-					void setMemoryOffset(byte v) noexcept { _value = v; }
-					void extractMemoryOffset(MemoryWord value) noexcept {
-						setMemoryOffset(byte((value & mask) >> shift));
-					}
-				private:
-					byte _value;
-			};
-
-
-
 			enum class CompareStyle : byte { 
 				Equals, 
 				NotEquals, 
@@ -287,37 +387,6 @@ namespace cisc0 {
 				MoveFromCondition, 
 				MoveToCondition, 
 			};
-			struct CompareGeneric  : public Extractable, public HasDestination, public HasStyle<CompareStyle, 0b0000000011100000, 5> {
-				virtual void extract(MemoryWord a, MemoryWord b = 0, MemoryWord c = 0) noexcept override {
-					extractDestination(a);
-					extractStyle(a);
-				}
-			};
-			struct CompareRegister : CompareGeneric, HasSource {
-				virtual void extract(MemoryWord a, MemoryWord b = 0, MemoryWord c = 0) noexcept override {
-					CompareGeneric::extract(a, b, c);
-					extractSource(a);
-				}
-			};
-			struct CompareImmediate : CompareGeneric, HasMaskableImmediateValue { 
-				virtual void extract(MemoryWord a, MemoryWord b, MemoryWord c) noexcept override {
-					CompareGeneric::extract(a, b, c);
-					HasMaskableImmediateValue::extract(a, b, c);
-				}
-			};
-			struct CompareMoveFromCondition : public Extractable, public HasDestination {
-				virtual void extract(MemoryWord a, MemoryWord b = 0, MemoryWord c = 0) noexcept override {
-					extractDestination(a);
-				}
-			};
-			struct CompareMoveToCondition : public Extractable, public HasDestination {
-				virtual void extract(MemoryWord a, MemoryWord b = 0, MemoryWord c = 0) noexcept override {
-					extractDestination(a);
-				}
-			};
-
-			using Compare = std::variant<CompareRegister, CompareImmediate, CompareMoveFromCondition, CompareMoveToCondition>;
-
 			enum class ArithmeticStyle : byte { 
 				Add,
 				Sub,
@@ -327,28 +396,6 @@ namespace cisc0 {
 				Min,
 				Max,
 			};
-			struct ArithmeticGeneric : Extractable, HasDestination, HasStyle<ArithmeticStyle, 0b0000000011100000, 5> { 
-				virtual void extract(MemoryWord a, MemoryWord b = 0, MemoryWord c = 0) noexcept override {
-					extractStyle(a);
-					extractDestination(a);
-				}
-			};
-			struct ArithmeticRegister : ArithmeticGeneric, HasSource { 
-				using Parent0 = ArithmeticGeneric;
-
-				virtual void extract(MemoryWord a, MemoryWord b = 0, MemoryWord c = 0) noexcept override {
-					Parent0::extract(a, b, c);
-					extractSource(a);
-				}
-			};
-			struct ArithmeticImmediate : ArithmeticGeneric, HasMaskableImmediateValue {
-				using Parent0 = ArithmeticGeneric;
-				virtual void extract(MemoryWord a, MemoryWord b, MemoryWord c) noexcept override {
-					Parent0::extract(a, b, c);
-					HasMaskableImmediateValue::extract(a, b, c);
-				}
-			};
-			using Arithmetic = std::variant<ArithmeticRegister, ArithmeticImmediate>;
 			enum class LogicalStyle : byte { 
 				And, 
 				Or, 
@@ -356,137 +403,12 @@ namespace cisc0 {
 				Nand, 
 				Not 
 			};
-			struct LogicalGeneric : Extractable, HasDestination, HasStyle<LogicalStyle, 0b0000000011100000, 5> { 
-				virtual void extract(MemoryWord a, MemoryWord b = 0, MemoryWord c = 0) noexcept override {
-					extractDestination(a);
-					extractStyle(a);
-				}
-			};
-			struct LogicalRegister : LogicalGeneric, HasSource { 
-				virtual void extract(MemoryWord a, MemoryWord b = 0, MemoryWord c = 0) noexcept override {
-					LogicalGeneric::extract(a, b, c);
-					extractSource(a);
-				}
-			};
-			struct LogicalImmediate : LogicalGeneric, HasMaskableImmediateValue { 
-				virtual void extract(MemoryWord a, MemoryWord b = 0, MemoryWord c = 0) noexcept override {
-					LogicalGeneric::extract(a, b, c);
-					HasMaskableImmediateValue::extract(a, b, c);
-				}
-			};
-			using Logical = std::variant<LogicalRegister, LogicalImmediate>;
-			struct ShiftGeneric : Extractable, HasDestination {
-				bool shiftLeft() const noexcept { return _shiftLeft; }
-				void setShiftLeft(bool value) noexcept { _shiftLeft = value; }
-				virtual void extract(MemoryWord a, MemoryWord b, MemoryWord c) noexcept override {
-					setShiftLeft(((a & 0b0000000000100000) >> 5) != 0);
-					extractDestination(a);
-				}
-				private:
-					bool _shiftLeft = false;
-			};
-			struct ShiftRegister : public ShiftGeneric, public HasSource {
-				virtual void extract(MemoryWord a, MemoryWord b = 0, MemoryWord c = 0) noexcept override {
-					ShiftGeneric::extract(a, b, c);
-					extractSource(a);
-				}
-			};
-			struct ShiftImmediate : ShiftGeneric {
-				void setShiftAmount(byte value) noexcept { _imm5 = value & 0b00011111; }
-				byte getShiftAmount() const noexcept { return _imm5; }
-				virtual void extract(MemoryWord a, MemoryWord b = 0, MemoryWord c = 0) noexcept override {
-					ShiftGeneric::extract(a, b, c);
-					setShiftAmount(byte((a & 0b0000111110000000) >> 7));
-				}
-				private:
-					byte _imm5;
-			};
-			using Shift = std::variant<ShiftRegister, ShiftImmediate>;
-			struct BranchGeneric : Extractable {
-				public:
-					bool conditionallyEvaluate() const noexcept { return _conditionallyEvaluate; }
-					bool performCall() const noexcept { return _performCall; }
-					void setConditionallyEvaluate(bool value) noexcept { _conditionallyEvaluate = value; }
-					void setPerformCall(bool value) noexcept { _performCall = value; }
-					virtual void extract(MemoryWord a, MemoryWord b, MemoryWord c) noexcept override {
-						setPerformCall(((a & 0b0000000000100000) >> 5) != 0);
-						setConditionallyEvaluate(((a & 0b0000000001000000) >> 6) != 0);
-					}
-				private:
-					bool _conditionallyEvaluate = false;
-					bool _performCall = false;
-			};
-			struct BranchRegister : BranchGeneric, HasDestination {
-				virtual void extract(MemoryWord a, MemoryWord b = 0, MemoryWord c = 0) noexcept override {
-					BranchGeneric::extract(a, b, c);
-					extractDestination(a);
-				}
-			};
-			struct BranchImmediate : BranchGeneric, HasImmediateValue {
-				virtual void extract(MemoryWord a, MemoryWord b, MemoryWord c) noexcept override {
-					BranchGeneric::extract(a, b, c);
-					extractImmediate(b, c);
-				}
-			};
-			using Branch = std::variant<BranchRegister, BranchImmediate>;
 			enum class MemoryStyle : byte {
 				Load,
 				Store,
 				Push,
 				Pop,
 			};
-			struct MemoryGeneric : Extractable, HasBitmask {
-				virtual void extract(MemoryWord a, MemoryWord b, MemoryWord c) noexcept override {
-					extractBitmask(a);
-				}
-			};
-			// use the destination field to store an offset
-			struct MemoryLoad : MemoryGeneric, HasMemoryOffset<0xF000, 12> {
-				virtual void extract(MemoryWord a, MemoryWord b = 0, MemoryWord c = 0) noexcept override {
-					MemoryGeneric::extract(a, b, c);
-					extractMemoryOffset(a);
-				}
-			};
-			struct MemoryStore : MemoryGeneric, HasMemoryOffset<0xF000, 12> { 
-				virtual void extract(MemoryWord a, MemoryWord b = 0, MemoryWord c = 0) noexcept override {
-					MemoryGeneric::extract(a, b, c);
-					extractMemoryOffset(a);
-				}
-			};
-			struct MemoryPush : MemoryGeneric, HasDestination { 
-				virtual void extract(MemoryWord a, MemoryWord b = 0, MemoryWord c = 0) noexcept override {
-					MemoryGeneric::extract(a, b, c);
-					extractDestination(a);
-				}
-			};
-			struct MemoryPop : MemoryGeneric, HasDestination {
-				virtual void extract(MemoryWord a, MemoryWord b = 0, MemoryWord c = 0) noexcept override {
-					MemoryGeneric::extract(a, b, c);
-					extractDestination(a);
-				}
-			};
-			using Memory = std::variant<MemoryLoad, MemoryStore, MemoryPush, MemoryPop>;
-
-			struct Move : Extractable, HasDestination, HasSource, HasBitmask {
-				virtual void extract(MemoryWord a, MemoryWord b = 0, MemoryWord c = 0) noexcept override {
-					extractDestination(a);
-					extractSource(a);
-					extractBitmask(a);
-				}
-			};
-			struct Set : HasDestination, HasMaskableImmediateValue { 
-				virtual void extract(MemoryWord a, MemoryWord b = 0, MemoryWord c = 0) noexcept override {
-					extractDestination(a);
-					HasMaskableImmediateValue::extract(a, b, c);
-				}
-			};
-			struct Swap : public Extractable, public HasDestination, public HasSource { 
-				virtual void extract(MemoryWord a, MemoryWord b = 0, MemoryWord c = 0) noexcept override {
-					extractDestination(a);
-					extractSource(a);
-				}
-
-			};
 			enum class MiscStyle {
 				Return,
 				Terminate,
@@ -495,177 +417,681 @@ namespace cisc0 {
                 ReadWord,
                 StringEquals,
                 StringCopy,
+                /// read up to dest characters into the words starting at src, dest becomes the count read
+                ReadBuffer,
+                /// write the low byte of the dest words starting at src, dest becomes the count written
+                WriteBuffer,
+			};
+			/**
+			 * Operations over a whole range of RAM, the range is the
+			 * ValueRegister words starting at the address in dest
+			 */
+			enum class BlockStyle : byte {
+				/// copy in the words starting at the address in src, the ranges may overlap
+				Copy,
+				/// store the lower half of src into every word
+				Fill,
+				/// set the condition register if the words match the ones starting at the address in src
+				Compare,
+				/// dest becomes how many words come before the first one equal to the lower half of src, the condition register is set if one was found
+				Search,
 			};
-			struct Return : Extractable { 
-				virtual void extract(MemoryWord a, MemoryWord b, MemoryWord c) noexcept override { }
+			/**
+			 * Flat identifier for every leaf operation, this is what the
+			 * execution engines dispatch on.
+			 */
+			enum class OperationKind : byte {
+				CompareRegister,
+				CompareImmediate,
+				CompareMoveFromCondition,
+				CompareMoveToCondition,
+				ArithmeticRegister,
+				ArithmeticImmediate,
+				LogicalRegister,
+				LogicalImmediate,
+				ShiftRegister,
+				ShiftImmediate,
+				BranchRegister,
+				BranchImmediate,
+				MemoryLoad,
+				MemoryStore,
+				MemoryPush,
+				MemoryPop,
+				Move,
+				Set,
+				Swap,
+				Return,
+				Terminate,
+				PutCharacter,
+				GetCharacter,
+				ReadWord,
+				StringEquals,
+				StringCopy,
+				ReadBuffer,
+				WriteBuffer,
+				BlockCopy,
+				BlockFill,
+				BlockCompare,
+				BlockSearch,
+				/// first word with an opcode beyond Block or an undefined block style
+				IllegalOpcode,
+				/// misc operation with an undefined style
+				IllegalMisc,
+				/// compare followed by a conditional immediate branch, only made by the decode cache
+				FusedCompareBranch,
+				/// set of the address register followed by a load or store, only made by the decode cache
+				FusedSetMemory,
+				Count,
 			};
-			struct Terminate : Extractable { 
-				virtual void extract(MemoryWord a, MemoryWord b, MemoryWord c) noexcept override { }
+			template<typename T>
+			static constexpr T extractStyle(MemoryWord value, MemoryWord mask = 0b00000000'11100000, byte shift = 5) {
+				return T((value & mask) >> shift);
+			}
+			/**
+			 * Turn a four bit byte mask into the 32-bit mask it describes
+			 */
+			static constexpr Address expandBitmask(Bitmask mask) noexcept {
+				Address result = 0;
+				for (int i = 0; i < 4; ++i) {
+					if ((mask & (1 << i)) != 0) {
+						result |= Address(0xFF) << (i * 8);
+					}
+				}
+				return result;
+			}
+			/**
+			 * A fully decoded instruction. Trivially copyable and small enough
+			 * to be stored, copied, and cached in bulk.
+			 */
+			struct Instruction {
+				public:
+					/**
+					 * Decode everything which can be determined from the
+					 * first word of an instruction. Instructions which
+					 * carry an immediate still need setExtensionWords.
+					 * Undefined encodings decode to an illegal kind which
+					 * raises the problem when it is executed.
+					 */
+					static constexpr Instruction fromFirstWord(MemoryWord first) noexcept {
+						Instruction out;
+						// every form keeps the destination in the upper
+						// nibble and the source in the one below it
+						out._registers = byte(first >> 8);
+						out._length = 1;
+						auto bitmask = Bitmask((first & 0x0F00) >> 8);
+						auto style = extractStyle<byte>(first);
+						auto immediate = extractImmediateBit(first);
+						using K = OperationKind;
+						switch (OperationCode(first & 0b1111)) {
+							case OperationCode::Memory:
+								switch (extractStyle<MemoryStyle>(first, 0b1100000, 5)) {
+									case MemoryStyle::Load:
+										out._kind = K::MemoryLoad;
+										out._style = byte(first >> 12);
+										break;
+									case MemoryStyle::Store:
+										out._kind = K::MemoryStore;
+										out._style = byte(first >> 12);
+										break;
+									case MemoryStyle::Push:
+										out._kind = K::MemoryPush;
+										break;
+									case MemoryStyle::Pop:
+										out._kind = K::MemoryPop;
+										break;
+								}
+								out._mask = expandBitmask(bitmask);
+								break;
+							case OperationCode::Arithmetic:
+								out._kind = immediate ? K::ArithmeticImmediate : K::ArithmeticRegister;
+								out._style = style;
+								break;
+							case OperationCode::Shift:
+								out._kind = immediate ? K::ShiftImmediate : K::ShiftRegister;
+								// direction in the upper bit, immediate shift amount below it
+								out._style = byte(((first & 0b0000000000100000) << 2) | ((first & 0b0000111110000000) >> 7));
+								break;
+							case OperationCode::Logical:
+								out._kind = immediate ? K::LogicalImmediate : K::LogicalRegister;
+								out._style = style;
+								break;
+							case OperationCode::Compare:
+								switch (CompareStyle(style)) {
+									case CompareStyle::MoveFromCondition:
+										out._kind = K::CompareMoveFromCondition;
+										break;
+									case CompareStyle::MoveToCondition:
+										out._kind = K::CompareMoveToCondition;
+										break;
+									default:
+										out._kind = immediate ? K::CompareImmediate : K::CompareRegister;
+										out._style = style;
+										break;
+								}
+								break;
+							case OperationCode::Branch:
+								out._kind = immediate ? K::BranchImmediate : K::BranchRegister;
+								// perform call in the lowest bit, conditional evaluation above it
+								out._style = byte((first & 0b0000000001100000) >> 5);
+								if (immediate) {
+									out._length = 3;
+								}
+								break;
+							case OperationCode::Move:
+								out._kind = K::Move;
+								out._mask = expandBitmask(bitmask);
+								break;
+							case OperationCode::Set:
+								// set never reads any extension words so the immediate is always zero
+								out._kind = K::Set;
+								out._mask = expandBitmask(bitmask);
+								break;
+							case OperationCode::Swap:
+								out._kind = K::Swap;
+								break;
+							case OperationCode::Misc:
+								switch (extractStyle<MiscStyle>(first, 0b11110000, 4)) {
+									case MiscStyle::Return:
+										out._kind = K::Return;
+										break;
+									case MiscStyle::Terminate:
+										out._kind = K::Terminate;
+										break;
+									case MiscStyle::PutCharacter:
+										out._kind = K::PutCharacter;
+										break;
+									case MiscStyle::GetCharacter:
+										out._kind = K::GetCharacter;
+										break;
+									case MiscStyle::ReadWord:
+										out._kind = K::ReadWord;
+										break;
+									case MiscStyle::StringEquals:
+										out._kind = K::StringEquals;
+										break;
+									case MiscStyle::StringCopy:
+										out._kind = K::StringCopy;
+										break;
+									case MiscStyle::ReadBuffer:
+										out._kind = K::ReadBuffer;
+										break;
+									case MiscStyle::WriteBuffer:
+										out._kind = K::WriteBuffer;
+										break;
+									default:
+										out._kind = K::IllegalMisc;
+										break;
+								}
+								break;
+							case OperationCode::Block:
+								switch (extractStyle<BlockStyle>(first, 0b11110000, 4)) {
+									case BlockStyle::Copy:
+										out._kind = K::BlockCopy;
+										break;
+									case BlockStyle::Fill:
+										out._kind = K::BlockFill;
+										break;
+									case BlockStyle::Compare:
+										out._kind = K::BlockCompare;
+										break;
+									case BlockStyle::Search:
+										out._kind = K::BlockSearch;
+										break;
+									default:
+										out._kind = K::IllegalOpcode;
+										break;
+								}
+								break;
+							default:
+								out._kind = K::IllegalOpcode;
+								break;
+						}
+						if (out.hasMaskableImmediate()) {
+							out._mask = expandBitmask(bitmask);
+							out._length = 1 + (out.getLowerMask() != 0 ? 1 : 0) + (out.getUpperMask() != 0 ? 1 : 0);
+						}
+						return out;
+					}
+					/**
+					 * Fill in the immediate value from the words following the
+					 * first, in the order they were fetched.
+					 */
+					constexpr void setExtensionWords(MemoryWord a, MemoryWord b = 0) noexcept {
+						if (_kind == OperationKind::BranchImmediate) {
+							// upper half comes first
+							_immediate = (Address(a) << 16) | Address(b);
+						} else if (hasMaskableImmediate()) {
+							auto lower = getLowerMask() != 0 ? a : 0;
+							auto upper = getLowerMask() != 0 ? b : a;
+							_immediate = ((Address(upper) << 16) | Address(lower)) & _mask;
+						}
+					}
+					constexpr bool hasMaskableImmediate() const noexcept {
+						return _kind == OperationKind::ArithmeticImmediate ||
+							   _kind == OperationKind::LogicalImmediate ||
+							   _kind == OperationKind::CompareImmediate;
+					}
+					constexpr OperationKind getKind() const noexcept { return _kind; }
+					constexpr RegisterIndex getDestination() const noexcept { return RegisterIndex(_registers >> 4); }
+					constexpr RegisterIndex getSource() const noexcept { return RegisterIndex(_registers & 0x0F); }
+					constexpr byte getLength() const noexcept { return _length; }
+					template<typename T>
+					constexpr T getStyle() const noexcept { return T(_style); }
+					constexpr bool shiftLeft() const noexcept { return (_style & 0b1000'0000) != 0; }
+					constexpr byte getShiftAmount() const noexcept { return _style & 0b0001'1111; }
+					constexpr bool performCall() const noexcept { return (_style & 0b01) != 0; }
+					constexpr bool conditionallyEvaluate() const noexcept { return (_style & 0b10) != 0; }
+					constexpr byte getMemoryOffset() const noexcept { return _style; }
+					constexpr Address getExpandedBitmask() const noexcept { return _mask; }
+					constexpr MemoryWord getLowerMask() const noexcept { return MemoryWord(_mask & 0x0000FFFF); }
+					constexpr MemoryWord getUpperMask() const noexcept { return MemoryWord((_mask & 0xFFFF0000) >> 16); }
+					constexpr Address getImmediate() const noexcept { return _immediate; }
+				private:
+					OperationKind _kind = OperationKind::Terminate;
+					/// destination in the upper nibble, source in the lower nibble
+					byte _registers = 0;
+					/// style, shift amount and direction, branch flags, or memory offset
+					byte _style = 0;
+					/// number of memory words the instruction occupies
+					byte _length = 0;
+					Address _mask = 0;
+					Address _immediate = 0;
+			};
+			struct CachedInstruction;
+			static constexpr bool countersEnabled = CISC0_COUNTERS != 0;
+			static constexpr byte maximumVariantCount = 8;
+			/**
+			 * Which flavor of its kind an instruction is: the style of
+			 * arithmetic, logical, and compare operations, the direction
+			 * of a shift, call and conditional flags of a branch, and
+			 * whether a memory operation has no, a partial, or a full mask.
+			 */
+			static constexpr byte getVariant(const Instruction& value) noexcept {
+				using K = OperationKind;
+				switch (value.getKind()) {
+					case K::ArithmeticRegister:
+					case K::ArithmeticImmediate:
+					case K::LogicalRegister:
+					case K::LogicalImmediate:
+					case K::CompareRegister:
+					case K::CompareImmediate:
+						return value.getStyle<byte>() & 0b111;
+					case K::ShiftRegister:
+					case K::ShiftImmediate:
+						return value.shiftLeft() ? 1 : 0;
+					case K::BranchRegister:
+					case K::BranchImmediate:
+						return (value.performCall() ? 0b01 : 0) | (value.conditionallyEvaluate() ? 0b10 : 0);
+					case K::MemoryLoad:
+					case K::MemoryStore:
+					case K::MemoryPush:
+					case K::MemoryPop:
+						return value.getExpandedBitmask() == 0 ? 0 : (value.getExpandedBitmask() == 0xFFFFFFFF ? 2 : 1);
+					default:
+						return 0;
+				}
+			}
+			static constexpr OperationCode getOperationCode(OperationKind kind) noexcept {
+				using K = OperationKind;
+				switch (kind) {
+					case K::CompareRegister:
+					case K::CompareImmediate:
+					case K::CompareMoveFromCondition:
+					case K::CompareMoveToCondition:
+						return OperationCode::Compare;
+					case K::ArithmeticRegister:
+					case K::ArithmeticImmediate:
+						return OperationCode::Arithmetic;
+					case K::LogicalRegister:
+					case K::LogicalImmediate:
+						return OperationCode::Logical;
+					case K::ShiftRegister:
+					case K::ShiftImmediate:
+						return OperationCode::Shift;
+					case K::BranchRegister:
+					case K::BranchImmediate:
+						return OperationCode::Branch;
+					case K::MemoryLoad:
+					case K::MemoryStore:
+					case K::MemoryPush:
+					case K::MemoryPop:
+						return OperationCode::Memory;
+					case K::Move:
+						return OperationCode::Move;
+					case K::Set:
+						return OperationCode::Set;
+					case K::Swap:
+						return OperationCode::Swap;
+					case K::BlockCopy:
+					case K::BlockFill:
+					case K::BlockCompare:
+					case K::BlockSearch:
+						return OperationCode::Block;
+					default:
+						return OperationCode::Misc;
+				}
+			}
+			static const char* getKindName(OperationKind kind) noexcept;
+			static const char* getOperationCodeName(OperationCode code) noexcept;
+			/// @return nullptr if the kind does not have the given variant
+			static const char* getVariantName(OperationKind kind, byte variant) noexcept;
+			/**
+			 * Counters describing what the core did while running
+			 */
+			struct Statistics {
+				/// instructions handed out for execution, fused pairs and compiled blocks count once
+				uint64_t _dispatches = 0;
+				/// compare and conditional branch pairs executed as one
+				uint64_t _fusedCompareBranches = 0;
+				/// set of the address register and load or store pairs executed as one
+				uint64_t _fusedSetMemories = 0;
+				/// compiled blocks run
+				uint64_t _compiledBlocks = 0;
+				/// instructions carried out by compiled blocks
+				uint64_t _compiledInstructions = 0;
+				/// number of guest instructions executed
+				constexpr uint64_t getInstructionCount() const noexcept {
+					return _dispatches + _fusedCompareBranches + _fusedSetMemories + _compiledInstructions - _compiledBlocks;
+				}
+#if CISC0_COUNTERS
+				/// instructions retired of each kind
+				uint64_t _kinds[byte(OperationKind::Count)] = { 0 };
+				/// instructions retired of each kind broken down by getVariant
+				uint64_t _variants[byte(OperationKind::Count)][maximumVariantCount] = { { 0 } };
+				/// time spent carrying out each kind, only with CISC0_COUNTER_TIMING
+				uint64_t _nanoseconds[byte(OperationKind::Count)] = { 0 };
+				uint64_t _branchesTaken = 0;
+				uint64_t _branchesNotTaken = 0;
+				uint64_t _calls = 0;
+#endif
+			};
+			/**
+			 * The different ways the core can execute instructions, all of
+			 * them produce the same architectural results.
+			 */
+			enum class ExecutionEngine : byte {
+				/// switch on the kind of each instruction
+				Standard,
+				/// jump straight to the handler of each instruction kind
+				Threaded,
+				/// interpret cold code and compile hot blocks to native code
+				Tiered,
+			};
+			/**
+			 * Where guest memory lives, both hold the same contents and
+			 * raise the same problems.
+			 */
+			enum class MemoryBackend : byte {
+				/// pages allocated on first write, every access is bounds checked
+				Paged,
+				/**
+				 * The whole 32-bit address space reserved up front with only
+				 * the capacity usable, an access past it faults and the fault
+				 * is turned into a Problem so in range accesses are not
+				 * checked at all. Only used by the execution engines while no
+				 * device is attached, forks go back to paged memory.
+				 */
+				Guarded,
 			};
-            struct PutCharacter : Extractable, HasDestination {
-                virtual void extract(MemoryWord a, MemoryWord b = 0, MemoryWord c = 0) noexcept override {
-                    extractDestination(a);
-                }
-            };
-            struct GetCharacter : Extractable, HasDestination {
-                virtual void extract(MemoryWord a, MemoryWord b = 0, MemoryWord c = 0) noexcept override {
-                    extractDestination(a);
-                }
-            };
-            /**
-             * Extract a single word (forth style) from input.
-             */
-            struct ReadWord : Extractable, HasDestination, HasSource {
-                virtual void extract(MemoryWord a, MemoryWord b = 0, MemoryWord c = 0) noexcept override {
-                    extractDestination(a);
-                    extractSource(a);
-                }
-            };
-            struct StringEquals : Extractable, HasSource, HasDestination {
-                virtual void extract(MemoryWord a, MemoryWord b = 0, MemoryWord c = 0) noexcept override {
-                    extractDestination(a);
-                    extractSource(a);
-                }
-            };
-            struct StringCopy : Extractable, HasSource, HasDestination {
-                virtual void extract(MemoryWord a, MemoryWord b = 0, MemoryWord c = 0) noexcept override {
-                    extractDestination(a);
-                    extractSource(a);
-                }
-            };
-			using Misc = std::variant<Return, 
-                  Terminate, 
-                  PutCharacter, 
-                  GetCharacter, 
-                  ReadWord,
-                  StringEquals,
-                  StringCopy>;
-
-			using Operation = std::variant<Compare, Arithmetic, Logical, Shift, Branch, Memory, Move, Set, Swap, Misc>;
 		public:
 			static constexpr Address defaultMemoryCapacity = 0xFFFFFF + 1;
+			/**
+			 * Stands in for the capacity in the templates which carry out
+			 * instructions when it is only known at run time. Any other
+			 * value is the capacity itself, which has to be a power of two
+			 * and turns bounds checks and wrap around into constants.
+			 */
+			static constexpr Address dynamicCapacity = 0;
+			/// stands in for the capacity when memory is guarded, it wraps like dynamicCapacity
+			static constexpr Address guardedCapacity = 0xFFFFFFFF;
+			/// number of entries in the direct mapped decode cache, must be a power of two
+			static constexpr Address decodeCacheSize = 4096;
 			Core(Address memoryCapacity = defaultMemoryCapacity);
+			~Core();
+			template<Address capacity = dynamicCapacity>
 			void storeWord(Address addr, MemoryWord value);
+			template<Address capacity = dynamicCapacity>
 			Address popSubroutineAddress() noexcept;
+			template<Address capacity = dynamicCapacity>
 			MemoryWord popSubroutineWord() noexcept;
+			template<Address capacity = dynamicCapacity>
 			MemoryWord popParameterWord() noexcept;
+			template<Address capacity = dynamicCapacity>
 			Address popParameterAddress() noexcept;
+			template<Address capacity = dynamicCapacity>
 			void pushParameterWord(MemoryWord value) noexcept;
+			template<Address capacity = dynamicCapacity>
 			void pushParameterAddress(Address value) noexcept;
+			template<Address capacity = dynamicCapacity>
 			void pushSubroutineWord(MemoryWord value) noexcept;
+			template<Address capacity = dynamicCapacity>
 			void pushSubroutineAddress(Address value) noexcept;
 			void run();
+			void setExecutionEngine(ExecutionEngine engine);
+			/// switch memory backends, this throws away the contents of memory so do it before install
+			void setMemoryBackend(MemoryBackend backend);
+			MemoryBackend getMemoryBackend() const noexcept { return _memory.getReservation() ? MemoryBackend::Guarded : MemoryBackend::Paged; }
+			ExecutionEngine getExecutionEngine() const noexcept { return _engine; }
+			const Statistics& getStatistics() const noexcept { return _statistics; }
+			/**
+			 * Write the statistics in a human readable form, or as JSON
+			 */
+			void printStatistics(std::ostream& out) const;
+			void writeStatistics(std::ostream& out) const;
+			/**
+			 * Make a new core which starts out exactly where this one is.
+			 * Registers are copied while memory pages are shared copy on
+			 * write, so the cost depends on how much memory is in use
+			 * rather than on the capacity. Forking is not thread safe with
+			 * respect to this core but the fork can run anywhere.
+			 */
+			std::unique_ptr<Core> fork();
+			/**
+			 * Bind the console of this core to the given channels instead
+			 * of standard input and output. Output is buffered and only
+			 * flushed when the buffer fills, before the core waits on
+			 * input, and when run returns or raises a Problem. A fork
+			 * starts out on standard input and output again.
+			 */
+			void setInput(std::shared_ptr<InputChannel> in) noexcept;
+			void setOutput(std::shared_ptr<OutputChannel> out) noexcept;
+			/// bind the console to streams which have to outlive the core
+			void setInput(std::istream& in);
+			void setOutput(std::ostream& out);
+			OutputChannel& getOutput() noexcept { return *_output; }
+			/**
+			 * Answer loads and stores to the given upper byte of the address
+			 * space with the device. RAM below the capacity always takes
+			 * precedence. Once a device is attached the address register
+			 * is no longer wrapped to the capacity, so addresses past the
+			 * end of RAM raise a Problem instead of wrapping around. A fork
+			 * starts out without any devices.
+			 */
+			void attachDevice(byte page, std::shared_ptr<Device> device);
+			/**
+			 * Sample the instruction pointer into the given profiler while
+			 * running, it has to outlive the run. Profiled runs go through
+			 * the interpreter so no instruction is hidden in a compiled
+			 * block, nullptr turns profiling back off.
+			 */
+			void setProfiler(Profiler* profiler) noexcept { _profiler = profiler; }
+			/**
+			 * Record every retired instruction into the given trace, it has
+			 * to outlive the run. Traced runs decode every instruction on
+			 * its own so fused pairs and compiled blocks show up one
+			 * instruction at a time, tracing takes precedence over
+			 * profiling.
+			 */
+			void setTrace(TraceWriter* trace) noexcept { _trace = trace; }
+			/**
+			 * Log every console read along with the number of instructions
+			 * retired when it happened, the log has to outlive the run
+			 */
+			void recordInput(InputLog* log) noexcept { _recordInput = log; }
+			/**
+			 * Take console reads from the given log instead of the input
+			 * stream. A Problem is raised if the guest reads at a different
+			 * point than it did when the log was recorded.
+			 */
+			void replayInput(InputLog* log) noexcept { _replayInput = log; }
 			void install(std::istream& in);
+			/**
+			 * Install the image stored in the given file. Where possible
+			 * guest memory becomes a private copy on write mapping of the
+			 * file so nothing is copied up front, otherwise the file is
+			 * read like any other stream.
+			 * @param path an image with the capacity of this core
+			 */
+			void install(const std::string& path);
 			void dump(std::ostream& out);
-			Register& getRegister(RegisterIndex index);
+			Register getRegister(RegisterIndex index) noexcept { return Register(_registers, index & 0x0F); }
 		private:
+			/// the microbenchmarks time the internals directly
+			friend class CoreBenchmark;
+			/// console reads through MMIO are recorded and replayed like any other
+			friend class ConsoleDevice;
+			template<Address capacity = dynamicCapacity>
 			MemoryWord loadWord(Address addr);
             Address loadAddress(Address addr);
             void storeAddress(Address addr, Address value);
 			template<byte index>
-			Register& getRegister() noexcept {
-				return _registers[index & 0x0F];
+			RegisterHandle<index & 0x0F> getRegister() noexcept {
+				return RegisterHandle<index & 0x0F>(_registers);
 			}
-			Register& getDestination(const HasDestination&);
-			Register& getSource(const HasSource&);
-			Register& getPC();
-			Register& getValueRegister() noexcept;
-			Register& getAddressRegister() noexcept;
-			template<typename T>
-			void variantInvoke(const T& value) {
-				std::visit([this](auto&& x) { invoke(x); }, value);
+			Register getDestination(const Instruction& value) noexcept { return getRegister(value.getDestination()); }
+			Register getSource(const Instruction& value) noexcept { return getRegister(value.getSource()); }
+			RegisterHandle<ArchitectureConstants::InstructionPointer> getPC() noexcept { return getRegister<ArchitectureConstants::InstructionPointer>(); }
+			RegisterHandle<ArchitectureConstants::ValueRegister> getValueRegister() noexcept { return getRegister<ArchitectureConstants::ValueRegister>(); }
+			RegisterHandle<ArchitectureConstants::AddressRegister> getAddressRegister() noexcept { return getRegister<ArchitectureConstants::AddressRegister>(); }
+			/// true if the template argument is the capacity itself
+			static constexpr bool isFixedCapacity(Address capacity) noexcept {
+				return capacity != dynamicCapacity && capacity != guardedCapacity;
 			}
-			MemoryWord nextWord();
-			void invoke(const Return& value);
-			void invoke(const Terminate& value);
-            void invoke(const PutCharacter& value);
-            void invoke(const GetCharacter& value);
-            void invoke(const ReadWord& value);
-            void invoke(const StringEquals& value);
-            void invoke(const StringCopy& value);
-			void invoke(const Misc& value);
-			void invoke(const Swap& value);
-			void invoke(const Set& value);
-			void invoke(const Move& value);
-			void invoke(const Memory& value);
-			void invoke(const MemoryPop& value);
-			void invoke(const MemoryPush& value);
-			void invoke(const MemoryStore& value);
-			void invoke(const MemoryLoad& value);
-			void invoke(const Branch& value);
-			void invoke(const BranchRegister& value);
-			void invoke(const BranchImmediate& value);
-			void invoke(const Shift& value);
-			void invoke(const ShiftRegister& value);
-			void invoke(const ShiftImmediate& value);
-			void invoke(const Logical& value);
-			void invoke(const LogicalRegister& value);
-			void invoke(const LogicalImmediate& value);
-			void invoke(const Arithmetic& value);
-			void invoke(const ArithmeticRegister& value);
-			void invoke(const ArithmeticImmediate& value);
-			void invoke(const Compare& value);
-			void invoke(const CompareRegister& value);
-			void invoke(const CompareImmediate& value);
-			void invoke(const CompareMoveToCondition& value);
-			void invoke(const CompareMoveFromCondition& value);
-			void invoke(const Operation& value);
-			Operation decode();
-			void decode(MemoryWord first, Return& value);
-			void decode(MemoryWord first, Terminate& value);
-			void decode(MemoryWord first, GetCharacter& value);
-			void decode(MemoryWord first, PutCharacter& value);
-            void decode(MemoryWord first, ReadWord& value);
-            void decode(MemoryWord first, StringCopy& value);
-            void decode(MemoryWord first, StringEquals& value);
-			void decode(MemoryWord first, Misc& value);
-			void decode(MemoryWord first, Swap& value);
-			void decode(MemoryWord first, Set& value);
-			void decode(MemoryWord first, Move& value);
-			void decode(MemoryWord first, Memory& value);
-			void decode(MemoryWord first, MemoryPop& value);
-			void decode(MemoryWord first, MemoryPush& value);
-			void decode(MemoryWord first, MemoryStore& value);
-			void decode(MemoryWord first, MemoryLoad& value);
-			void decode(MemoryWord first, Branch& value);
-			void decode(MemoryWord first, BranchRegister& value);
-			void decode(MemoryWord first, BranchImmediate& value);
-			void decode(MemoryWord first, Shift& value);
-			void decode(MemoryWord first, ShiftRegister& value);
-			void decode(MemoryWord first, ShiftImmediate& value);
-			void decode(MemoryWord first, Logical& value);
-			void decode(MemoryWord first, LogicalRegister& value);
-			void decode(MemoryWord first, LogicalImmediate& value);
-			void decode(MemoryWord first, Arithmetic& value);
-			void decode(MemoryWord first, ArithmeticRegister& value);
-			void decode(MemoryWord first, ArithmeticImmediate& value);
-			void decode(MemoryWord first, Compare& value);
-			void decode(MemoryWord first, CompareRegister& value);
-			void decode(MemoryWord first, CompareImmediate& value);
-			void decode(MemoryWord first, CompareMoveToCondition& value);
-			void decode(MemoryWord first, CompareMoveFromCondition& value);
-			template<typename T, typename ImmediateType, typename RegisterType>
-			void decodeOnImmediateBit(MemoryWord first, T& value) {
-				if (extractImmediateBit(first)) {
-					value = ImmediateType();
+			/// move the instruction pointer, wrapping it to the capacity
+			template<Address capacity>
+			void setPC(Address addr) noexcept {
+				static_assert(!isFixedCapacity(capacity) || (capacity & (capacity - 1)) == 0, "A fixed capacity has to be a power of two!");
+				if constexpr (!isFixedCapacity(capacity)) {
+					_registers.set<ArchitectureConstants::InstructionPointer>(addr);
 				} else {
-					value = RegisterType();
+					_registers.assign<ArchitectureConstants::InstructionPointer>(addr & (capacity - 1));
 				}
-				std::visit([this, first](auto&& value) { decode(first, value); }, value);
-			}
-			template<typename T>
-			void decodeImmediateValue(MemoryWord first, T& value) {
-				auto second = MemoryWord(0);
-				auto third = MemoryWord(0);
-				value.extractBitmask(first);
-				if (auto lowerMask = value.getLowerMask(); lowerMask != 0) {
-					second = nextWord();
-				}
-				if (auto upperMask = value.getUpperMask(); upperMask != 0) {
-					third = nextWord();
-				}
-				value.extract(first, second, third);
 			}
+			template<Address capacity = dynamicCapacity>
+			MemoryWord nextWord();
+			template<OperationKind kind>
+			struct OperationTag { };
+			/**
+			 * Carry out a single instruction of the given kind, each kind
+			 * has its own overload.
+			 */
+			template<Address capacity> void invoke(OperationTag<OperationKind::CompareRegister>, const Instruction& value);
+			template<Address capacity> void invoke(OperationTag<OperationKind::CompareImmediate>, const Instruction& value);
+			template<Address capacity> void invoke(OperationTag<OperationKind::CompareMoveFromCondition>, const Instruction& value);
+			template<Address capacity> void invoke(OperationTag<OperationKind::CompareMoveToCondition>, const Instruction& value);
+			template<Address capacity> void invoke(OperationTag<OperationKind::ArithmeticRegister>, const Instruction& value);
+			template<Address capacity> void invoke(OperationTag<OperationKind::ArithmeticImmediate>, const Instruction& value);
+			template<Address capacity> void invoke(OperationTag<OperationKind::LogicalRegister>, const Instruction& value);
+			template<Address capacity> void invoke(OperationTag<OperationKind::LogicalImmediate>, const Instruction& value);
+			template<Address capacity> void invoke(OperationTag<OperationKind::ShiftRegister>, const Instruction& value);
+			template<Address capacity> void invoke(OperationTag<OperationKind::ShiftImmediate>, const Instruction& value);
+			template<Address capacity> void invoke(OperationTag<OperationKind::BranchRegister>, const Instruction& value);
+			template<Address capacity> void invoke(OperationTag<OperationKind::BranchImmediate>, const Instruction& value);
+			template<Address capacity> void invoke(OperationTag<OperationKind::MemoryLoad>, const Instruction& value);
+			template<Address capacity> void invoke(OperationTag<OperationKind::MemoryStore>, const Instruction& value);
+			template<Address capacity> void invoke(OperationTag<OperationKind::MemoryPush>, const Instruction& value);
+			template<Address capacity> void invoke(OperationTag<OperationKind::MemoryPop>, const Instruction& value);
+			template<Address capacity> void invoke(OperationTag<OperationKind::Move>, const Instruction& value);
+			template<Address capacity> void invoke(OperationTag<OperationKind::Set>, const Instruction& value);
+			template<Address capacity> void invoke(OperationTag<OperationKind::Swap>, const Instruction& value);
+			template<Address capacity> void invoke(OperationTag<OperationKind::Return>, const Instruction& value);
+			template<Address capacity> void invoke(OperationTag<OperationKind::Terminate>, const Instruction& value);
+			template<Address capacity> void invoke(OperationTag<OperationKind::PutCharacter>, const Instruction& value);
+			template<Address capacity> void invoke(OperationTag<OperationKind::GetCharacter>, const Instruction& value);
+			template<Address capacity> void invoke(OperationTag<OperationKind::ReadWord>, const Instruction& value);
+			template<Address capacity> void invoke(OperationTag<OperationKind::StringEquals>, const Instruction& value);
+			template<Address capacity> void invoke(OperationTag<OperationKind::StringCopy>, const Instruction& value);
+			template<Address capacity> void invoke(OperationTag<OperationKind::ReadBuffer>, const Instruction& value);
+			template<Address capacity> void invoke(OperationTag<OperationKind::WriteBuffer>, const Instruction& value);
+			template<Address capacity> void invoke(OperationTag<OperationKind::BlockCopy>, const Instruction& value);
+			template<Address capacity> void invoke(OperationTag<OperationKind::BlockFill>, const Instruction& value);
+			template<Address capacity> void invoke(OperationTag<OperationKind::BlockCompare>, const Instruction& value);
+			template<Address capacity> void invoke(OperationTag<OperationKind::BlockSearch>, const Instruction& value);
+			template<Address capacity> void invoke(OperationTag<OperationKind::IllegalOpcode>, const Instruction& value);
+			template<Address capacity> void invoke(OperationTag<OperationKind::IllegalMisc>, const Instruction& value);
+			/**
+			 * Invoke the instruction and account for it when the counters
+			 * are compiled in, otherwise the same as invoke
+			 */
+			template<Address capacity, OperationKind kind>
+			void retire(const Instruction& value);
+			/**
+			 * Carry out the given instruction by switching on its kind
+			 */
+			template<Address capacity = dynamicCapacity>
+			void execute(const Instruction& value);
+			/**
+			 * Carry out the given cache entry, which may be a fused pair
+			 */
+			template<Address capacity = dynamicCapacity>
+			void execute(const CachedInstruction& entry);
+			template<Address capacity> void invokeFused(OperationTag<OperationKind::FusedCompareBranch>, const CachedInstruction& entry);
+			template<Address capacity> void invokeFused(OperationTag<OperationKind::FusedSetMemory>, const CachedInstruction& entry);
+			void compare(const Instruction& value, Address src);
+			void arithmetic(const Instruction& value, Address src);
+			void logical(const Instruction& value, Address src);
+			void shift(const Instruction& value, Address amount);
+			template<Address capacity>
+			void branch(const Instruction& value, Address whereToGo);
+			/**
+			 * Decode the instruction at the instruction pointer, the
+			 * instruction pointer is moved past it.
+			 */
+			template<Address capacity = dynamicCapacity>
+			Instruction decode();
+			/**
+			 * Decode the instruction at the instruction pointer, reusing a
+			 * previous decode of the same address if the cache has one.
+			 * Advances the instruction pointer just like decode does.
+			 * @return the cache entry holding the decoded instruction
+			 */
+			template<Address capacity = dynamicCapacity>
+			const CachedInstruction& fetch();
+			/**
+			 * Try to fuse the instruction following a freshly decoded cache
+			 * entry into it. The instruction pointer is moved past the
+			 * second instruction only if the pair is fused.
+			 */
+			template<Address capacity = dynamicCapacity>
+			void fuse(CachedInstruction& entry);
+			/// run on the selected engine, built for the given capacity
+			template<Address capacity>
+			void runEngine();
+			template<Address capacity>
+			void runStandard();
+			template<Address capacity>
+			void runThreaded();
+			template<Address capacity>
+			void runTiered();
+			/// run on guarded memory, turning faults back into problems
+			void runGuarded();
+			void runProfiled();
+			void runTraced();
+			/**
+			 * Keep track of how often a branch target is reached and compile
+			 * it once it gets hot enough.
+			 */
+			void noteBranchTarget(Address target, bool isCall);
+			void compileBlock(Address start);
+			/// throw away the native code decoded from any of the length words starting at base
+			void invalidateCompiledBlocks(Address base, Address length = 1);
+			void flushCompiledBlocks() noexcept;
+			/**
+			 * Throw away any cached decodes which contain the given address
+			 * @param addr the memory address which was just modified
+			 */
+			void invalidateDecodeCache(Address addr) noexcept;
+			void flushDecodeCache() noexcept;
             /**
              * Given a memory address, construct a string from the data found there.
              * @param base Address to start at
@@ -673,12 +1099,87 @@ namespace cisc0 {
              */
             std::string loadString(Address base);
             void storeString(Address base, Address count, const std::string& value);
+            /**
+             * StringCopy and StringEquals carried out in place on RAM, the
+             * characters still go through a char on the way so the results
+             * match loadString and storeString. Anything touching devices
+             * or illegal addresses goes through those instead.
+             */
+            void copyString(Address dest, Address src);
+            bool compareStrings(Address a, Address b);
+			/// console reads, recorded or replayed as asked
+			Integer readCharacter();
+			std::string readWord();
+			/**
+			 * Move a whole buffer between guest memory and the console a
+			 * page at a time, only RAM can take part.
+			 * @return how many characters were moved
+			 */
+			Address readBuffer(Address base, Address count);
+			Address writeBuffer(Address base, Address count);
+			/// widen the characters into the words starting at base
+			void fillMemory(Address base, const char* data, Address length);
+			/**
+			 * The block operations, only RAM can take part and every range
+			 * is checked before anything is written.
+			 */
+			void copyBlock(Address dest, Address src, Address count);
+			void fillBlock(Address dest, MemoryWord value, Address count);
+			bool compareBlock(Address a, Address b, Address count);
+			/// @return how many words come before the first match, count if there is none
+			Address searchBlock(Address base, MemoryWord value, Address count);
+			void checkBufferRange(Address base, Address count) const;
+			/// true if the count words starting at base are all RAM
+			bool inCapacity(Address base, DoubleAddress count) const noexcept {
+				return DoubleAddress(base) + count <= _capacity;
+			}
+			/// drop any decodes or compiled blocks made stale by writing to the words starting at base
+			void invalidateRange(Address base, Address length);
+			/// trace the words just written in place starting at base and drop anything stale
+			void noteStores(Address base, Address length);
 		private:
 			Address _capacity;
-			std::unique_ptr<Register[]> _registers;
-			std::unique_ptr<MemoryWord[]> _memory;
+			RegisterFile _registers;
+			PagedMemory _memory;
+			std::unique_ptr<CachedInstruction[]> _decodeCache;
+			std::unique_ptr<Jit> _jit;
+			std::unique_ptr<uint16_t[]> _branchTargetCounts;
 			bool _conditionRegister = false;
 			bool _keepExecuting = true;
+			ExecutionEngine _engine = ExecutionEngine::Standard;
+			Statistics _statistics;
+			std::shared_ptr<InputChannel> _input;
+			std::shared_ptr<OutputChannel> _output;
+			Profiler* _profiler = nullptr;
+			DeviceBus _devices;
+			TraceWriter* _trace = nullptr;
+			InputLog* _recordInput = nullptr;
+			InputLog* _replayInput = nullptr;
+	};
+	/**
+	 * A decoded instruction along with the address it was decoded from.
+	 * Used by the decode cache so that hot code is not decoded over and
+	 * over again.
+	 */
+	struct Core::CachedInstruction {
+		Address _address = 0;
+		bool _valid = false;
+		/// what to dispatch on, the kind of the instruction or a fused pair
+		OperationKind _handler = OperationKind::Terminate;
+		/// native code starting at this address, if any
+		const CompiledBlock* _block = nullptr;
+		Instruction _instruction;
+		/// the instruction fused into this one, only valid for fused handlers
+		Instruction _second;
+		constexpr bool isFused() const noexcept {
+			return _handler == OperationKind::FusedCompareBranch || _handler == OperationKind::FusedSetMemory;
+		}
+		/// number of memory words covered by this entry
+		constexpr Address getLength() const noexcept {
+			return _instruction.getLength() + (isFused() ? _second.getLength() : 0);
+		}
 	};
+	static_assert(std::is_trivially_copyable_v<Core::Instruction>, "Decoded instructions must be trivially copyable!");
+	static_assert(sizeof(Core::Instruction) <= 12, "Decoded instructions should stay compact!");
 } // end namespace cisc0
 #endif
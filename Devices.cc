@@ -0,0 +1,224 @@
+/**
+ * @file
+ * the ROM and MMIO devices of doc/cisc0/memory_map
+ * @copyright
+ * cisc0
+ * Copyright (c) 2013-2018, Joshua Scoggins and Contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "Devices.h"
+#include "Problem.h"
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace cisc0 {
+	static Problem unmapped(Address addr) {
+		std::stringstream msg;
+		msg << "Nothing is mapped at device address 0x" << std::hex << addr << "!";
+		return Problem(msg.str());
+	}
+	SecondaryStorage::SecondaryStorage(const std::string& path, Address blockCount) {
+		auto fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+		if (fd < 0) {
+			throw Problem("could not open storage " + path + ": " + std::strerror(errno));
+		}
+		struct stat info;
+		auto wanted = off_t(size_t(blockCount) * blockSize * sizeof(MemoryWord));
+		if (fstat(fd, &info) != 0 || (info.st_size < wanted && ftruncate(fd, wanted) != 0)) {
+			auto reason = std::strerror(errno);
+			::close(fd);
+			throw Problem("could not size storage " + path + ": " + reason);
+		}
+		// a larger file is used as is, a trailing partial block is ignored
+		_length = size_t(info.st_size < wanted ? wanted : info.st_size);
+		_blockCount = Address(_length / (blockSize * sizeof(MemoryWord)));
+		auto mapping = mmap(nullptr, _length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (mapping == MAP_FAILED) {
+			throw Problem("could not map storage " + path + ": " + std::strerror(errno));
+		}
+		_mapping = static_cast<byte*>(mapping);
+		_helper = std::thread([this]() { transferLoop(); });
+	}
+	SecondaryStorage::~SecondaryStorage() {
+		{
+			std::lock_guard<std::mutex> guard(_lock);
+			_done = true;
+		}
+		_wake.notify_all();
+		_helper.join();
+		munmap(_mapping, _length);
+	}
+	void SecondaryStorage::waitUntilReady() {
+		if (_status.load(std::memory_order_acquire) != Status::Busy) {
+			return;
+		}
+		std::unique_lock<std::mutex> guard(_lock);
+		_wake.wait(guard, [this]() { return !_pending; });
+	}
+	void SecondaryStorage::start(Command command) {
+		waitUntilReady();
+		if ((command != Command::Read && command != Command::Write) || _block >= _blockCount) {
+			_status.store(Status::Error, std::memory_order_release);
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> guard(_lock);
+			_command = command;
+			_transferBlock = _block;
+			_pending = true;
+			_status.store(Status::Busy, std::memory_order_release);
+		}
+		_wake.notify_all();
+	}
+	void SecondaryStorage::transferLoop() {
+		std::unique_lock<std::mutex> guard(_lock);
+		while (true) {
+			_wake.wait(guard, [this]() { return _pending || _done; });
+			// a transfer started right before the core went away still
+			// has to land in the file
+			if (!_pending) {
+				return;
+			}
+			// the guest waits on the status before touching the cache so
+			// the copy can run without holding the lock
+			guard.unlock();
+			auto block = _mapping + size_t(_transferBlock) * blockSize * sizeof(MemoryWord);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			if (_command == Command::Read) {
+				std::memcpy(_cache, block, sizeof(_cache));
+			} else {
+				std::memcpy(block, _cache, sizeof(_cache));
+			}
+#else
+			for (Address i = 0; i < blockSize; ++i) {
+				if (_command == Command::Read) {
+					_cache[i] = MemoryWord(block[2 * i]) | (MemoryWord(block[2 * i + 1]) << 8);
+				} else {
+					block[2 * i] = byte(_cache[i]);
+					block[2 * i + 1] = byte(_cache[i] >> 8);
+				}
+			}
+#endif
+			guard.lock();
+			_pending = false;
+			_status.store(Status::Ready, std::memory_order_release);
+			_wake.notify_all();
+		}
+	}
+	MemoryWord SecondaryStorage::load(Address offset) {
+		switch (offset) {
+			case memoryMap::storageCommand:
+				return MemoryWord(_status.load(std::memory_order_acquire));
+			case memoryMap::storageBlockLower:
+				return MemoryWord(_block);
+			case memoryMap::storageBlockUpper:
+				return MemoryWord(_block >> 16);
+			default:
+				waitUntilReady();
+				return _cache[offset - memoryMap::storageCache];
+		}
+	}
+	void SecondaryStorage::store(Address offset, MemoryWord value) {
+		switch (offset) {
+			case memoryMap::storageCommand:
+				start(Command(value));
+				break;
+			case memoryMap::storageBlockLower:
+				_block = (_block & 0xFFFF0000) | value;
+				break;
+			case memoryMap::storageBlockUpper:
+				_block = (_block & 0x0000FFFF) | (Address(value) << 16);
+				break;
+			default:
+				waitUntilReady();
+				_cache[offset - memoryMap::storageCache] = value;
+				break;
+		}
+	}
+	MemoryWord IoPage::load(Address addr) {
+		auto offset = addr - memoryMap::ioBase;
+		if (_storage && memoryMap::isStorage(offset)) {
+			return _storage->load(offset);
+		}
+		switch (offset) {
+			case memoryMap::console:
+				return _console.read();
+			case memoryMap::randomValue:
+				return _random.next();
+			case memoryMap::randomStateLower:
+				return MemoryWord(_random.getState());
+			case memoryMap::randomStateUpper:
+				return MemoryWord(_random.getState() >> 16);
+			default:
+				throw unmapped(addr);
+		}
+	}
+	void IoPage::store(Address addr, MemoryWord value) {
+		auto offset = addr - memoryMap::ioBase;
+		if (_storage && memoryMap::isStorage(offset)) {
+			_storage->store(offset, value);
+			return;
+		}
+		switch (offset) {
+			case memoryMap::console:
+				_console.write(value);
+				break;
+			case memoryMap::randomStateLower:
+				_random.setState((_random.getState() & 0xFFFF0000) | value);
+				break;
+			case memoryMap::randomStateUpper:
+				_random.setState((_random.getState() & 0x0000FFFF) | (Address(value) << 16));
+				break;
+			default:
+				throw unmapped(addr);
+		}
+	}
+	std::shared_ptr<RomDevice> RomDevice::read(std::istream& in) {
+		std::vector<MemoryWord> contents;
+		char pair[2];
+		while (in.read(pair, 2)) {
+			contents.push_back(MemoryWord(byte(pair[0])) | (MemoryWord(byte(pair[1])) << 8));
+		}
+		if (contents.size() > (1 << PagedMemory::regionShift)) {
+			throw Problem("ROM image is larger than the ROM page!");
+		}
+		return std::make_shared<RomDevice>(std::move(contents));
+	}
+	void RomDevice::store(Address, MemoryWord) {
+		throw Problem("Attempted to write to ROM!");
+	}
+	void attachStandardDevices(Core& core, std::shared_ptr<RomDevice> rom, std::shared_ptr<SecondaryStorage> storage) {
+		core.attachDevice(memoryMap::ioPage, std::make_shared<IoPage>(core, std::move(storage)));
+		if (rom) {
+			core.attachDevice(memoryMap::romPage, std::move(rom));
+		}
+	}
+} // end namespace cisc0
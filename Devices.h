@@ -0,0 +1,189 @@
+/**
+ * @file
+ * the ROM and MMIO devices of doc/cisc0/memory_map
+ * @copyright
+ * cisc0
+ * Copyright (c) 2013-2018, Joshua Scoggins and Contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef _CISC0_DEVICES_H
+#define _CISC0_DEVICES_H
+#include "Core.h"
+#include "Channel.h"
+#include <atomic>
+#include <condition_variable>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cisc0 {
+	/// where things live according to doc/cisc0/memory_map
+	namespace memoryMap {
+		constexpr byte romPage = 0xFE;
+		constexpr byte ioPage = 0xFF;
+		constexpr Address romBase = Address(romPage) << PagedMemory::regionShift;
+		constexpr Address ioBase = Address(ioPage) << PagedMemory::regionShift;
+		// offsets into the io page
+		/// read a character (0xFFFF once input runs out), write a character
+		constexpr Address console = 0x000;
+		/// read the next random word
+		constexpr Address randomValue = 0x001;
+		/// read or replace the lower and upper halves of the generator state
+		constexpr Address randomStateLower = 0x002;
+		constexpr Address randomStateUpper = 0x003;
+		/// write a StorageCommand, read a StorageStatus
+		constexpr Address storageCommand = 0x004;
+		/// block the next command transfers, lower then upper half
+		constexpr Address storageBlockLower = 0x005;
+		constexpr Address storageBlockUpper = 0x006;
+		/// one block of storage, what commands transfer to and from
+		constexpr Address storageCache = 0x100;
+		constexpr Address storageCacheEnd = 0x1FF;
+		constexpr bool isStorage(Address offset) noexcept {
+			return (offset >= storageCommand && offset <= storageBlockUpper) || (offset >= storageCache && offset <= storageCacheEnd);
+		}
+	} // end namespace memoryMap
+	/**
+	 * The console of a core behind a single word, the same channels as
+	 * the misc console operations so recording and replay see both
+	 */
+	class ConsoleDevice {
+		public:
+			explicit ConsoleDevice(Core& core) noexcept : _core(core) { }
+			MemoryWord read() {
+				auto c = _core.readCharacter();
+				return c < 0 ? 0xFFFF : MemoryWord(c);
+			}
+			void write(MemoryWord value) { _core.getOutput().put(char(value)); }
+		private:
+			Core& _core;
+	};
+	/// xorshift random numbers, the same sequence every run unless reseeded
+	class RandomDevice {
+		public:
+			static constexpr Address defaultState = 0x2545F491;
+			MemoryWord next() noexcept {
+				_state ^= _state << 13;
+				_state ^= _state >> 17;
+				_state ^= _state << 5;
+				return MemoryWord(_state);
+			}
+			Address getState() const noexcept { return _state; }
+			/// a state of zero would only ever produce zero so it is replaced
+			void setState(Address state) noexcept { _state = state == 0 ? defaultState : state; }
+		private:
+			Address _state = defaultState;
+	};
+	/**
+	 * Secondary storage backed by a shared mapping of a host file, so
+	 * whatever the guest writes persists. Blocks move between the file
+	 * and the disk cache window on a helper thread; the guest starts a
+	 * transfer by writing a command and polls the command register until
+	 * it reads back Ready. Touching the cache or starting another command
+	 * while a transfer is in flight waits for it to finish first, so a
+	 * guest which never polls still sees consistent data.
+	 */
+	class SecondaryStorage {
+		public:
+			static constexpr Address blockSize = memoryMap::storageCacheEnd - memoryMap::storageCache + 1;
+			static constexpr Address defaultBlockCount = 4096;
+			enum class Command : MemoryWord {
+				/// copy the selected block into the cache
+				Read = 1,
+				/// copy the cache into the selected block
+				Write = 2,
+			};
+			enum class Status : MemoryWord {
+				Ready = 0,
+				Busy = 1,
+				/// the last command was unknown or the block was out of range
+				Error = 0xFFFF,
+			};
+			/**
+			 * Map the given file, which is created or grown to hold
+			 * blockCount blocks if it is any smaller. Raises a Problem if
+			 * it can't be mapped.
+			 */
+			SecondaryStorage(const std::string& path, Address blockCount = defaultBlockCount);
+			~SecondaryStorage();
+			SecondaryStorage(const SecondaryStorage&) = delete;
+			SecondaryStorage& operator=(const SecondaryStorage&) = delete;
+			Address getBlockCount() const noexcept { return _blockCount; }
+			MemoryWord load(Address offset);
+			void store(Address offset, MemoryWord value);
+		private:
+			void start(Command command);
+			void waitUntilReady();
+			void transferLoop();
+		private:
+			/// the file as little endian words
+			byte* _mapping = nullptr;
+			size_t _length = 0;
+			Address _blockCount = 0;
+			MemoryWord _cache[blockSize] = { 0 };
+			Address _block = 0;
+			std::atomic<Status> _status { Status::Ready };
+			// the transfer handed to the helper thread
+			Command _command = Command::Read;
+			Address _transferBlock = 0;
+			bool _pending = false;
+			bool _done = false;
+			std::mutex _lock;
+			std::condition_variable _wake;
+			std::thread _helper;
+	};
+	/// the device MMIO page
+	class IoPage : public Device {
+		public:
+			IoPage(Core& core, std::shared_ptr<SecondaryStorage> storage = nullptr) noexcept : _console(core), _storage(std::move(storage)) { }
+			MemoryWord load(Address addr) override;
+			void store(Address addr, MemoryWord value) override;
+		private:
+			ConsoleDevice _console;
+			RandomDevice _random;
+			std::shared_ptr<SecondaryStorage> _storage;
+	};
+	/// read only memory, words past the end of the contents read as zero
+	class RomDevice : public Device {
+		public:
+			explicit RomDevice(std::vector<MemoryWord> contents) noexcept : _contents(std::move(contents)) { }
+			/// little endian words, as many as the stream holds
+			static std::shared_ptr<RomDevice> read(std::istream& in);
+			MemoryWord load(Address addr) override {
+				auto offset = addr & 0xFFFFFF;
+				return offset < _contents.size() ? _contents[offset] : 0;
+			}
+			void store(Address addr, MemoryWord value) override;
+		private:
+			std::vector<MemoryWord> _contents;
+	};
+	/**
+	 * Lay out the devices of the memory map on the given core, the ROM
+	 * page and storage registers are left empty if not given
+	 */
+	void attachStandardDevices(Core& core, std::shared_ptr<RomDevice> rom = nullptr, std::shared_ptr<SecondaryStorage> storage = nullptr);
+} // end namespace cisc0
+#endif // end _CISC0_DEVICES_H
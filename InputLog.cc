@@ -0,0 +1,154 @@
+/**
+ * @file
+ * recording and replaying of console input
+ * @copyright
+ * cisc0
+ * Copyright (c) 2013-2018, Joshua Scoggins and Contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "InputLog.h"
+#include "Problem.h"
+#include <sstream>
+
+namespace cisc0 {
+	void InputLog::append(Event event) {
+		_events.push_back(std::move(event));
+		if (_sink) {
+			write(*_sink, _events.back());
+		}
+	}
+	void InputLog::character(uint64_t instructions, Integer value) {
+		append(Event { instructions, Type::Character, value, "" });
+	}
+	void InputLog::word(uint64_t instructions, const std::string& value) {
+		append(Event { instructions, Type::Word, 0, value });
+	}
+	void InputLog::buffer(uint64_t instructions, const std::string& value) {
+		append(Event { instructions, Type::Buffer, 0, value });
+	}
+	const char* InputLog::describe(Type type) noexcept {
+		switch (type) {
+			case Type::Character:
+				return "character";
+			case Type::Word:
+				return "word";
+			default:
+				return "buffer";
+		}
+	}
+	const InputLog::Event& InputLog::next(uint64_t instructions, Type type) {
+		if (_next >= _events.size()) {
+			std::stringstream msg;
+			msg << "Replay ran out of input at instruction " << instructions << "!";
+			throw Problem(msg.str());
+		}
+		auto& event = _events[_next];
+		if (event._type != type || event._instructions != instructions) {
+			std::stringstream msg;
+			msg << "Replay diverged at input event " << _next << ": recorded a " << describe(event._type);
+			msg << " read at instruction " << event._instructions << " but the guest made a " << describe(type);
+			msg << " read at instruction " << instructions << "!";
+			throw Problem(msg.str());
+		}
+		++_next;
+		return event;
+	}
+	Integer InputLog::nextCharacter(uint64_t instructions) {
+		return next(instructions, Type::Character)._character;
+	}
+	std::string InputLog::nextWord(uint64_t instructions) {
+		return next(instructions, Type::Word)._text;
+	}
+	std::string InputLog::nextBuffer(uint64_t instructions, Address limit) {
+		auto& event = next(instructions, Type::Buffer);
+		if (event._text.size() > limit) {
+			std::stringstream msg;
+			msg << "Replay diverged at input event " << (_next - 1) << ": recorded a buffer read of " << event._text.size();
+			msg << " characters but the guest only asked for " << limit << "!";
+			throw Problem(msg.str());
+		}
+		return event._text;
+	}
+	void InputLog::write(std::ostream& out, const Event& event) {
+		static constexpr char digits[] = "0123456789abcdef";
+		out << char(event._type) << " " << event._instructions << " ";
+		switch (event._type) {
+			case Type::Word:
+				out << event._text.size() << " " << event._text;
+				break;
+			case Type::Buffer:
+				out << event._text.size() << " ";
+				for (auto c : event._text) {
+					auto b = static_cast<unsigned char>(c);
+					out << digits[b >> 4] << digits[b & 0x0F];
+				}
+				break;
+			default:
+				out << event._character;
+				break;
+		}
+		out << std::endl;
+	}
+	void InputLog::save(std::ostream& out) const {
+		for (auto& event : _events) {
+			write(out, event);
+		}
+	}
+	void InputLog::load(std::istream& in) {
+		_events.clear();
+		_next = 0;
+		std::string type;
+		while (in >> type) {
+			if (type != "w" && type != "c" && type != "b") {
+				throw Problem("Unknown input event type: " + type);
+			}
+			Event event { 0, Type(type[0]), 0, "" };
+			in >> event._instructions;
+			if (event._type == Type::Character) {
+				in >> event._character;
+			} else {
+				size_t length = 0;
+				in >> length;
+				std::string text;
+				if (length > 0) {
+					in >> text;
+				}
+				if (event._type == Type::Word) {
+					event._text = text;
+				} else if (text.size() == length * 2 && text.find_first_not_of("0123456789abcdef") == std::string::npos) {
+					for (size_t i = 0; i < text.size(); i += 2) {
+						event._text += char(std::stoi(text.substr(i, 2), nullptr, 16));
+					}
+				}
+				if (event._text.size() != length) {
+					throw Problem(std::string("Malformed ") + describe(event._type) + " in input log!");
+				}
+			}
+			if (!in) {
+				throw Problem("Malformed input log!");
+			}
+			_events.push_back(event);
+		}
+	}
+} // end namespace cisc0
@@ -0,0 +1,98 @@
+/**
+ * @file
+ * recording and replaying of console input
+ * @copyright
+ * cisc0
+ * Copyright (c) 2013-2018, Joshua Scoggins and Contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef _CISC0_INPUT_LOG_H
+#define _CISC0_INPUT_LOG_H
+#include "Core.h"
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace cisc0 {
+	/**
+	 * Every console read a guest made, in order, along with the number of
+	 * instructions which had retired when it was made. Recording appends
+	 * to the log (and optionally writes each event through to a stream
+	 * so nothing is lost if the guest dies), replaying hands the events
+	 * back from memory.
+	 *
+	 * On disk each event is a line of text, a character read is
+	 * "c instructions value", a word read is
+	 * "w instructions length word" where an empty word has no text, and
+	 * a buffer read is "b instructions length hex" since a buffer can
+	 * hold anything.
+	 */
+	class InputLog {
+		public:
+			enum class Type : char {
+				Character = 'c',
+				Word = 'w',
+				Buffer = 'b',
+			};
+			struct Event {
+				uint64_t _instructions;
+				Type _type;
+				Integer _character;
+				/// the word or buffer read
+				std::string _text;
+			};
+		public:
+			InputLog() = default;
+			/// write each recorded event through to the given stream as well
+			explicit InputLog(std::ostream& sink) : _sink(&sink) { }
+			void character(uint64_t instructions, Integer value);
+			void word(uint64_t instructions, const std::string& value);
+			void buffer(uint64_t instructions, const std::string& value);
+			/**
+			 * The next event, which has to be of the right type and
+			 * happen at the same point the recording did
+			 */
+			Integer nextCharacter(uint64_t instructions);
+			std::string nextWord(uint64_t instructions);
+			/// @param limit the most the guest asked for, a longer recording is a divergence
+			std::string nextBuffer(uint64_t instructions, Address limit);
+			/// replace the events with those stored in the stream
+			void load(std::istream& in);
+			void save(std::ostream& out) const;
+			const std::vector<Event>& getEvents() const noexcept { return _events; }
+			/// start replaying from the first event again
+			void rewind() noexcept { _next = 0; }
+			bool exhausted() const noexcept { return _next == _events.size(); }
+		private:
+			const Event& next(uint64_t instructions, Type type);
+			void append(Event event);
+			static const char* describe(Type type) noexcept;
+			static void write(std::ostream& out, const Event& event);
+		private:
+			std::vector<Event> _events;
+			size_t _next = 0;
+			std::ostream* _sink = nullptr;
+	};
+} // end namespace cisc0
+#endif // end _CISC0_INPUT_LOG_H
@@ -0,0 +1,440 @@
+/**
+ * @file
+ * x86-64 code generation for hot cisc0 blocks
+ * @copyright
+ * cisc0
+ * Copyright (c) 2013-2018, Joshua Scoggins and Contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "Jit.h"
+#include "Problem.h"
+#include <cstring>
+#include <sys/mman.h>
+
+namespace cisc0 {
+	static_assert(sizeof(Address) * RegisterFile::count <= 0x80, "Generated code expects every register to be reachable with an 8-bit displacement!");
+	// the generated code is called with the register values in rdi and the
+	// condition register in rsi, eax/ecx/edx are used as scratch
+	constexpr byte RegisterBase = 7; // rdi
+	constexpr byte ConditionRegister = 6; // rsi
+	Jit::Jit() {
+		if (!supported()) {
+			return;
+		}
+		auto mem = mmap(nullptr, codeBufferSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mem == MAP_FAILED) {
+			throw Problem("Unable to allocate the jit code buffer!");
+		}
+		_code = static_cast<byte*>(mem);
+	}
+	Jit::~Jit() {
+		if (_code) {
+			munmap(_code, codeBufferSize);
+		}
+	}
+	void Jit::emit(std::initializer_list<byte> bytes) {
+		_pending.insert(_pending.end(), bytes);
+	}
+	void Jit::emit32(Address value) {
+		emit({ byte(value), byte(value >> 8), byte(value >> 16), byte(value >> 24) });
+	}
+	void Jit::load(HostRegister reg, RegisterIndex index) {
+		// mov reg, [rdi + disp8]
+		emit({ 0x8B, byte(0x40 | (reg << 3) | RegisterBase), byte(index * sizeof(Address)) });
+	}
+	void Jit::loadImmediate(HostRegister reg, Address value) {
+		// mov reg, imm32
+		emit({ byte(0xB8 + reg) });
+		emit32(value);
+	}
+	void Jit::store(HostRegister reg, RegisterIndex index) {
+		// masking is only done for the registers which actually need it
+		if (auto mask = _registers->getMask(index); mask != 0xFFFFFFFF) {
+			// and reg, imm32
+			emit({ 0x81, byte(0xE0 | reg) });
+			emit32(mask);
+		}
+		// mov [rdi + disp8], reg
+		emit({ 0x89, byte(0x40 | (reg << 3) | RegisterBase), byte(index * sizeof(Address)) });
+	}
+	void Jit::beginBlock(const RegisterFile& registers) {
+		_registers = &registers;
+		_pending.clear();
+	}
+	const CompiledBlock* Jit::endBlock(Address start, Address end, Address wordCount, Address instructionCount) {
+		emit({ 0xC3 }); // ret
+		if (_used + _pending.size() > codeBufferSize) {
+			return nullptr;
+		}
+		mprotect(_code, codeBufferSize, PROT_READ | PROT_WRITE);
+		auto target = _code + _used;
+		std::memcpy(target, _pending.data(), _pending.size());
+		_used += _pending.size();
+		mprotect(_code, codeBufferSize, PROT_READ | PROT_EXEC);
+		// the block walks downward through memory just like the instruction pointer
+		auto lowest = start - (wordCount - 1);
+		if (_blocks.empty()) {
+			_lowestCovered = lowest;
+			_highestCovered = start;
+		} else {
+			_lowestCovered = lowest < _lowestCovered ? lowest : _lowestCovered;
+			_highestCovered = start > _highestCovered ? start : _highestCovered;
+		}
+		_longestBlock = wordCount > _longestBlock ? wordCount : _longestBlock;
+		auto& block = _blocks[start];
+		block._start = start;
+		block._end = end;
+		block._wordCount = wordCount;
+		block._instructionCount = instructionCount;
+		block._code = reinterpret_cast<CompiledBlock::NativeCode>(target);
+		return &block;
+	}
+	const CompiledBlock* Jit::find(Address start) const noexcept {
+		if (auto result = _blocks.find(start); result != _blocks.end()) {
+			return &result->second;
+		} else {
+			return nullptr;
+		}
+	}
+	void Jit::invalidate(Address base, Address length, std::vector<Address>& removed) {
+		if (length == 0) {
+			return;
+		}
+		// a block covers the words from its start down, so only blocks
+		// starting in the range or up to the longest block past it can
+		// reach into it
+		auto last = base + (length - 1);
+		for (auto it = _blocks.lower_bound(base); it != _blocks.end() && DoubleAddress(it->first) < DoubleAddress(last) + _longestBlock; ) {
+			auto& block = it->second;
+			if (last > block._start - block._wordCount) {
+				removed.emplace_back(block._start);
+				it = _blocks.erase(it);
+			} else {
+				++it;
+			}
+		}
+	}
+	void Jit::flush() noexcept {
+		_blocks.clear();
+		_longestBlock = 0;
+		_used = 0;
+	}
+	constexpr bool touchesInstructionPointer(RegisterIndex index) noexcept {
+		return index == Core::ArchitectureConstants::InstructionPointer;
+	}
+	bool Jit::translateCompare(Core::CompareStyle style) {
+		// eax holds the destination and ecx the source, all compares are unsigned
+		byte condition = 0;
+		using T = Core::CompareStyle;
+		switch (style) {
+			case T::Equals:
+				condition = 0x94; // sete
+				break;
+			case T::NotEquals:
+				condition = 0x95; // setne
+				break;
+			case T::LessThan:
+				condition = 0x92; // setb
+				break;
+			case T::GreaterThan:
+				condition = 0x97; // seta
+				break;
+			case T::LessThanOrEqualTo:
+				condition = 0x96; // setbe
+				break;
+			case T::GreaterThanOrEqualTo:
+				condition = 0x93; // setae
+				break;
+			default:
+				return false;
+		}
+		emit({ 0x39, 0xC8 }); // cmp eax, ecx
+		emit({ 0x0F, condition, 0xC0 }); // setcc al
+		emit({ 0x88, byte(ConditionRegister) }); // mov [rsi], al
+		return true;
+	}
+	template<>
+	bool Jit::translate<Core::OperationKind::CompareRegister>(const Core::Instruction& op) {
+		if (touchesInstructionPointer(op.getDestination()) || touchesInstructionPointer(op.getSource())) {
+			return false;
+		}
+		load(EAX, op.getDestination());
+		load(ECX, op.getSource());
+		return translateCompare(op.getStyle<Core::CompareStyle>());
+	}
+	template<>
+	bool Jit::translate<Core::OperationKind::CompareImmediate>(const Core::Instruction& op) {
+		if (touchesInstructionPointer(op.getDestination())) {
+			return false;
+		}
+		load(EAX, op.getDestination());
+		loadImmediate(ECX, op.getImmediate());
+		return translateCompare(op.getStyle<Core::CompareStyle>());
+	}
+	template<>
+	bool Jit::translate<Core::OperationKind::CompareMoveFromCondition>(const Core::Instruction& op) {
+		if (touchesInstructionPointer(op.getDestination())) {
+			return false;
+		}
+		emit({ 0x0F, 0xB6, byte(ConditionRegister) }); // movzx eax, byte [rsi]
+		emit({ 0xF7, 0xD8 }); // neg eax
+		store(EAX, op.getDestination());
+		return true;
+	}
+	template<>
+	bool Jit::translate<Core::OperationKind::CompareMoveToCondition>(const Core::Instruction& op) {
+		if (touchesInstructionPointer(op.getDestination())) {
+			return false;
+		}
+		load(EAX, op.getDestination());
+		emit({ 0x85, 0xC0 }); // test eax, eax
+		emit({ 0x0F, 0x95, 0xC0 }); // setne al
+		emit({ 0x88, byte(ConditionRegister) }); // mov [rsi], al
+		return true;
+	}
+	bool Jit::translateArithmetic(Core::ArithmeticStyle style, RegisterIndex dest) {
+		// eax holds the destination and ecx the source
+		using T = Core::ArithmeticStyle;
+		switch (style) {
+			case T::Add:
+				emit({ 0x01, 0xC8 }); // add eax, ecx
+				break;
+			case T::Sub:
+				emit({ 0x29, 0xC8 }); // sub eax, ecx
+				break;
+			case T::Mul:
+				emit({ 0x0F, 0xAF, 0xC1 }); // imul eax, ecx
+				break;
+			case T::Div:
+			case T::Rem:
+				emit({ 0x31, 0xD2 }); // xor edx, edx
+				emit({ 0xF7, 0xF1 }); // div ecx
+				if (style == T::Rem) {
+					emit({ 0x89, 0xD0 }); // mov eax, edx
+				}
+				break;
+			case T::Min:
+				emit({ 0x39, 0xC8 }); // cmp eax, ecx
+				emit({ 0x0F, 0x47, 0xC1 }); // cmova eax, ecx
+				store(EAX, Core::ArchitectureConstants::ValueRegister);
+				return true;
+			case T::Max:
+				emit({ 0x39, 0xC8 }); // cmp eax, ecx
+				emit({ 0x0F, 0x42, 0xC1 }); // cmovb eax, ecx
+				store(EAX, Core::ArchitectureConstants::ValueRegister);
+				return true;
+			default:
+				// the interpreter does nothing for the undefined style
+				return true;
+		}
+		store(EAX, dest);
+		return true;
+	}
+	template<>
+	bool Jit::translate<Core::OperationKind::ArithmeticRegister>(const Core::Instruction& op) {
+		if (touchesInstructionPointer(op.getDestination()) || touchesInstructionPointer(op.getSource())) {
+			return false;
+		}
+		using T = Core::ArithmeticStyle;
+		if (op.getStyle<T>() == T::Div || op.getStyle<T>() == T::Rem) {
+			// could divide by zero, let the interpreter raise the problem
+			return false;
+		}
+		load(EAX, op.getDestination());
+		load(ECX, op.getSource());
+		return translateArithmetic(op.getStyle<T>(), op.getDestination());
+	}
+	template<>
+	bool Jit::translate<Core::OperationKind::ArithmeticImmediate>(const Core::Instruction& op) {
+		if (touchesInstructionPointer(op.getDestination())) {
+			return false;
+		}
+		using T = Core::ArithmeticStyle;
+		if ((op.getStyle<T>() == T::Div || op.getStyle<T>() == T::Rem) && op.getImmediate() == 0) {
+			return false;
+		}
+		load(EAX, op.getDestination());
+		loadImmediate(ECX, op.getImmediate());
+		return translateArithmetic(op.getStyle<T>(), op.getDestination());
+	}
+	bool Jit::translateLogical(Core::LogicalStyle style, RegisterIndex dest) {
+		// eax holds the destination and ecx the source
+		using T = Core::LogicalStyle;
+		switch (style) {
+			case T::And:
+				emit({ 0x21, 0xC8 }); // and eax, ecx
+				break;
+			case T::Or:
+				emit({ 0x09, 0xC8 }); // or eax, ecx
+				break;
+			case T::Xor:
+				emit({ 0x31, 0xC8 }); // xor eax, ecx
+				break;
+			case T::Not:
+				emit({ 0x89, 0xC8 }); // mov eax, ecx
+				emit({ 0xF7, 0xD0 }); // not eax
+				break;
+			case T::Nand:
+				emit({ 0x21, 0xC8 }); // and eax, ecx
+				emit({ 0xF7, 0xD0 }); // not eax
+				break;
+			default:
+				// illegal styles raise a problem in the interpreter
+				return false;
+		}
+		store(EAX, dest);
+		return true;
+	}
+	template<>
+	bool Jit::translate<Core::OperationKind::LogicalRegister>(const Core::Instruction& op) {
+		if (touchesInstructionPointer(op.getDestination()) || touchesInstructionPointer(op.getSource())) {
+			return false;
+		}
+		load(EAX, op.getDestination());
+		load(ECX, op.getSource());
+		return translateLogical(op.getStyle<Core::LogicalStyle>(), op.getDestination());
+	}
+	template<>
+	bool Jit::translate<Core::OperationKind::LogicalImmediate>(const Core::Instruction& op) {
+		if (touchesInstructionPointer(op.getDestination())) {
+			return false;
+		}
+		load(EAX, op.getDestination());
+		loadImmediate(ECX, op.getImmediate());
+		return translateLogical(op.getStyle<Core::LogicalStyle>(), op.getDestination());
+	}
+	template<>
+	bool Jit::translate<Core::OperationKind::ShiftRegister>(const Core::Instruction& op) {
+		if (touchesInstructionPointer(op.getDestination()) || touchesInstructionPointer(op.getSource())) {
+			return false;
+		}
+		load(EAX, op.getDestination());
+		load(ECX, op.getSource());
+		// shl/shr eax, cl
+		emit({ 0xD3, byte(op.shiftLeft() ? 0xE0 : 0xE8) });
+		store(EAX, op.getDestination());
+		return true;
+	}
+	template<>
+	bool Jit::translate<Core::OperationKind::ShiftImmediate>(const Core::Instruction& op) {
+		if (touchesInstructionPointer(op.getDestination())) {
+			return false;
+		}
+		load(EAX, op.getDestination());
+		// shl/shr eax, imm8
+		emit({ 0xC1, byte(op.shiftLeft() ? 0xE0 : 0xE8), op.getShiftAmount() });
+		store(EAX, op.getDestination());
+		return true;
+	}
+	template<>
+	bool Jit::translate<Core::OperationKind::Move>(const Core::Instruction& op) {
+		if (touchesInstructionPointer(op.getDestination()) || touchesInstructionPointer(op.getSource())) {
+			return false;
+		}
+		load(EAX, op.getSource());
+		emit({ 0x25 }); // and eax, imm32
+		emit32(op.getExpandedBitmask());
+		store(EAX, op.getDestination());
+		return true;
+	}
+	template<>
+	bool Jit::translate<Core::OperationKind::Set>(const Core::Instruction& op) {
+		if (touchesInstructionPointer(op.getDestination())) {
+			return false;
+		}
+		loadImmediate(EAX, op.getImmediate());
+		store(EAX, op.getDestination());
+		return true;
+	}
+	template<>
+	bool Jit::translate<Core::OperationKind::Swap>(const Core::Instruction& op) {
+		if (touchesInstructionPointer(op.getDestination()) || touchesInstructionPointer(op.getSource())) {
+			return false;
+		}
+		if (op.getDestination() == op.getSource()) {
+			return true;
+		}
+		load(EAX, op.getDestination());
+		load(ECX, op.getSource());
+		store(ECX, op.getDestination());
+		store(EAX, op.getSource());
+		return true;
+	}
+	bool Jit::translate(const Core::Instruction& op) {
+		if (!supported()) {
+			return false;
+		}
+		auto size = _pending.size();
+		auto result = false;
+		using T = Core::OperationKind;
+		switch (op.getKind()) {
+			case T::CompareRegister:
+				result = translate<T::CompareRegister>(op);
+				break;
+			case T::CompareImmediate:
+				result = translate<T::CompareImmediate>(op);
+				break;
+			case T::CompareMoveFromCondition:
+				result = translate<T::CompareMoveFromCondition>(op);
+				break;
+			case T::CompareMoveToCondition:
+				result = translate<T::CompareMoveToCondition>(op);
+				break;
+			case T::ArithmeticRegister:
+				result = translate<T::ArithmeticRegister>(op);
+				break;
+			case T::ArithmeticImmediate:
+				result = translate<T::ArithmeticImmediate>(op);
+				break;
+			case T::LogicalRegister:
+				result = translate<T::LogicalRegister>(op);
+				break;
+			case T::LogicalImmediate:
+				result = translate<T::LogicalImmediate>(op);
+				break;
+			case T::ShiftRegister:
+				result = translate<T::ShiftRegister>(op);
+				break;
+			case T::ShiftImmediate:
+				result = translate<T::ShiftImmediate>(op);
+				break;
+			case T::Move:
+				result = translate<T::Move>(op);
+				break;
+			case T::Set:
+				result = translate<T::Set>(op);
+				break;
+			case T::Swap:
+				result = translate<T::Swap>(op);
+				break;
+			default:
+				break;
+		}
+		if (!result) {
+			// throw away anything partially generated
+			_pending.resize(size);
+		}
+		return result;
+	}
+} // end namespace cisc0
@@ -0,0 +1,143 @@
+/**
+ * @file
+ * translation of hot cisc0 code into native x86-64 code
+ * @copyright
+ * cisc0
+ * Copyright (c) 2013-2018, Joshua Scoggins and Contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef _CISC0_JIT_H
+#define _CISC0_JIT_H
+#include "Core.h"
+#include <map>
+#include <vector>
+
+namespace cisc0 {
+	/**
+	 * A straight line run of cisc0 instructions which has been translated
+	 * into native code.
+	 */
+	struct CompiledBlock {
+		using NativeCode = void(*)(Address* registers, bool* condition);
+		/// address of the first instruction in the block
+		Address _start;
+		/// where the instruction pointer ends up once the block is done
+		Address _end;
+		/// number of memory words the block was decoded from
+		Address _wordCount;
+		/// number of cisc0 instructions which make up the block
+		Address _instructionCount;
+		NativeCode _code;
+	};
+	/**
+	 * Translates register only cisc0 operations into x86-64 code. Anything
+	 * which touches memory, the instruction pointer, changes control flow,
+	 * or could raise a Problem is left for the interpreter. This keeps the
+	 * generated code free of anything which could throw.
+	 */
+	class Jit {
+		public:
+			/// number of times a branch target has to be hit before it is compiled
+			static constexpr Address hotThreshold = 64;
+			/// longest run of instructions to put into a single block
+			static constexpr Address maximumBlockLength = 256;
+			static constexpr size_t codeBufferSize = 1024 * 1024;
+			/**
+			 * Is there a native code generator for this host?
+			 */
+			static constexpr bool supported() noexcept {
+#if defined(__x86_64__)
+				return true;
+#else
+				return false;
+#endif
+			}
+		public:
+			Jit();
+			~Jit();
+			/**
+			 * Start generating a new block
+			 * @param registers the register file the block will operate on, the masks are baked into the generated code
+			 */
+			void beginBlock(const RegisterFile& registers);
+			/**
+			 * Append the given operation to the current block
+			 * @return false if the operation has to be left to the interpreter
+			 */
+			bool translate(const Core::Instruction& op);
+			/**
+			 * Finish the current block and make it executable
+			 * @return the newly compiled block or nullptr if the code buffer is full
+			 */
+			const CompiledBlock* endBlock(Address start, Address end, Address wordCount, Address instructionCount);
+			const CompiledBlock* find(Address start) const noexcept;
+			/**
+			 * Does any compiled block possibly contain the given address?
+			 */
+			bool covers(Address addr) const noexcept {
+				return !_blocks.empty() && addr >= _lowestCovered && addr <= _highestCovered;
+			}
+			/// does any compiled block possibly contain one of the length words starting at base?
+			bool covers(Address base, Address length) const noexcept {
+				return !_blocks.empty() && length != 0 && DoubleAddress(base) + length > _lowestCovered && base <= _highestCovered;
+			}
+			/**
+			 * Throw away every block which was decoded from any of the
+			 * length words starting at base, the range must not wrap
+			 * @param removed the start address of each discarded block is appended here
+			 */
+			void invalidate(Address base, Address length, std::vector<Address>& removed);
+			/**
+			 * Discard every compiled block
+			 */
+			void flush() noexcept;
+		private:
+			enum HostRegister : byte {
+				EAX = 0,
+				ECX = 1,
+				EDX = 2,
+			};
+			template<Core::OperationKind kind>
+			bool translate(const Core::Instruction&) { return false; }
+			bool translateArithmetic(Core::ArithmeticStyle style, RegisterIndex dest);
+			bool translateLogical(Core::LogicalStyle style, RegisterIndex dest);
+			bool translateCompare(Core::CompareStyle style);
+			void emit(std::initializer_list<byte> bytes);
+			void emit32(Address value);
+			void load(HostRegister reg, RegisterIndex index);
+			void loadImmediate(HostRegister reg, Address value);
+			void store(HostRegister reg, RegisterIndex index);
+		private:
+			byte* _code = nullptr;
+			size_t _used = 0;
+			const RegisterFile* _registers = nullptr;
+			std::vector<byte> _pending;
+			std::map<Address, CompiledBlock> _blocks;
+			Address _lowestCovered = 0;
+			Address _highestCovered = 0;
+			/// largest word count of any block, bounds how far invalidate has to look
+			Address _longestBlock = 0;
+	};
+} // end namespace cisc0
+#endif // end _CISC0_JIT_H
@@ -27,12 +27,14 @@
 #include "Problem.h"
 #include <iostream>
 #include <fstream>
+#include <iomanip>
 #include <list>
+#include <map>
 #include <type_traits>
 
 
 void usage(const std::string& name) {
-	std::cerr << name << ": <path-to-object> [more objects, -o fileName]" << std::endl;
+	std::cerr << name << ": <path-to-object> [more objects, -o fileName, -m mapFileName]" << std::endl;
 }
 using Address = cisc0::Address;
 int main(int argc, char** argv) {
@@ -42,15 +44,22 @@ int main(int argc, char** argv) {
 		return 1;
 	}
 	bool findOutput = false;
+	bool findMap = false;
 	std::string output = "iris.img";
+	std::string mapOutput;
 	std::list<std::string> files;
 	for (int i = 1; i < argc; ++i) {
 		std::string value = argv[i];
 		if (findOutput) {
 			output = value;
 			findOutput = false;
+		} else if (findMap) {
+			mapOutput = value;
+			findMap = false;
 		} else if (value == "-o") {
 			findOutput = true;
+		} else if (value == "-m") {
+			findMap = true;
 		} else {
 			files.emplace_back(value);
 		}
@@ -62,6 +71,8 @@ int main(int argc, char** argv) {
 		bool _viewAsRegister = false;
 	};
 	std::list<InstallationTarget> installs;
+	// symbol address to name, several names may share an address
+	std::multimap<cisc0::Address, std::string> symbols;
 	// TODO: continue this and generate a system image based off of it
 	for (auto const & path : files) {
 		std::ifstream in(path.c_str(), std::ios::binary);
@@ -83,6 +94,7 @@ int main(int argc, char** argv) {
 			auto upper = cisc0::Address(getWord()) << 16;
 			return lower | upper;
 		};
+		std::string symbolName;
 		while (in) {
 			// read each entry to see what to do with it
 			auto section = getWord();
@@ -101,6 +113,14 @@ int main(int argc, char** argv) {
 				case 2: // installation of memory
 					installs.emplace_back(address, value);
 					break;
+				case 3: // one character of a symbol name, zero ends the name
+					if (value == 0) {
+						symbols.emplace(address, symbolName);
+						symbolName.clear();
+					} else {
+						symbolName += char(value);
+					}
+					break;
 				default:
 					std::cerr << "Got an illegal section, terminating..." << std::endl;
 					std::cerr << "\tThe culprint file is: " << path << std::endl;
@@ -133,5 +153,15 @@ int main(int argc, char** argv) {
 		}
 		file.close();
 	}
+	if (!mapOutput.empty()) {
+		std::ofstream file(mapOutput.c_str());
+		if (!file.is_open()) {
+			std::cerr << "could not open: " << mapOutput << " for writing!" << std::endl;
+			return 1;
+		}
+		for (const auto & symbol : symbols) {
+			file << std::hex << std::setw(8) << std::setfill('0') << symbol.first << " " << symbol.second << std::endl;
+		}
+	}
 	return 0;
 }
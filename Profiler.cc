@@ -0,0 +1,166 @@
+/**
+ * @file
+ * sampling of the guest instruction pointer
+ * @copyright
+ * cisc0
+ * Copyright (c) 2013-2018, Joshua Scoggins and Contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "Profiler.h"
+#include "Problem.h"
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <sys/time.h>
+
+namespace cisc0 {
+	/// flag of the profiler which owns the timer, set from the signal handler
+	static std::atomic<std::atomic<bool>*> timerTarget { nullptr };
+	static void onProfilingTimer(int) {
+		if (auto target = timerTarget.load(std::memory_order_relaxed); target) {
+			target->store(true, std::memory_order_relaxed);
+		}
+	}
+
+	Profiler::Profiler(Address interval) : _interval(interval), _ring(std::make_unique<Address[]>(ringCapacity)) { }
+	Profiler::~Profiler() {
+		stopTimer();
+		stopCollector();
+	}
+	void Profiler::startTimer(unsigned int hertz) {
+		if (hertz == 0) {
+			throw Problem("Profiling timer frequency must be greater than zero!");
+		}
+		std::atomic<bool>* expected = nullptr;
+		if (!timerTarget.compare_exchange_strong(expected, &_timerExpired)) {
+			throw Problem("Another profiler already owns the profiling timer!");
+		}
+		struct sigaction action = { };
+		action.sa_handler = onProfilingTimer;
+		sigemptyset(&action.sa_mask);
+		action.sa_flags = SA_RESTART;
+		sigaction(SIGPROF, &action, nullptr);
+		struct itimerval timer = { };
+		timer.it_interval.tv_sec = 0;
+		timer.it_interval.tv_usec = hertz >= 1'000'000 ? 1 : 1'000'000 / hertz;
+		timer.it_value = timer.it_interval;
+		setitimer(ITIMER_PROF, &timer, nullptr);
+	}
+	void Profiler::stopTimer() {
+		if (timerTarget.load() != &_timerExpired) {
+			return;
+		}
+		struct itimerval timer = { };
+		setitimer(ITIMER_PROF, &timer, nullptr);
+		signal(SIGPROF, SIG_IGN);
+		timerTarget.store(nullptr);
+	}
+	void Profiler::startCollector() {
+		if (_collecting.exchange(true)) {
+			return;
+		}
+		_collector = std::thread([this]() {
+				while (_collecting.load(std::memory_order_relaxed)) {
+					drain();
+					std::this_thread::sleep_for(std::chrono::milliseconds(10));
+				}
+			});
+	}
+	void Profiler::stopCollector() {
+		if (!_collecting.exchange(false)) {
+			return;
+		}
+		_collector.join();
+		drain();
+	}
+	void Profiler::drain() {
+		auto tail = _tail.load(std::memory_order_relaxed);
+		auto head = _head.load(std::memory_order_acquire);
+		for (; tail != head; ++tail) {
+			++_histogram[_ring[tail & (ringCapacity - 1)]];
+			++_total;
+		}
+		_tail.store(tail, std::memory_order_release);
+	}
+	void Profiler::loadSymbols(std::istream& in) {
+		std::string line;
+		while (std::getline(in, line)) {
+			std::istringstream fields(line);
+			Address addr = 0;
+			std::string name;
+			if (!(fields >> std::hex >> addr >> name)) {
+				continue;
+			}
+			// keep the first name given to an address
+			_symbols.emplace(addr, name);
+		}
+	}
+	std::pair<std::string, Address> Profiler::rangeOf(Address addr) const {
+		// code is laid out walking downward so a symbol covers its own
+		// address down to just above the next lower symbol
+		if (auto symbol = _symbols.lower_bound(addr); symbol != _symbols.end()) {
+			return { symbol->second, symbol->first };
+		}
+		auto start = addr | (defaultRangeWidth - 1);
+		std::ostringstream name;
+		name << std::hex << "0x" << start << "-0x" << (start - (defaultRangeWidth - 1));
+		return { name.str(), start };
+	}
+	void Profiler::report(std::ostream& out, size_t limit) {
+		drain();
+		std::map<std::string, uint64_t> ranges;
+		std::vector<std::pair<Address, uint64_t>> addresses(_histogram.begin(), _histogram.end());
+		for (auto& sample : addresses) {
+			ranges[rangeOf(sample.first).first] += sample.second;
+		}
+		std::vector<std::pair<std::string, uint64_t>> byRange(ranges.begin(), ranges.end());
+		auto bySamples = [](auto& a, auto& b) { return a.second != b.second ? a.second > b.second : a.first < b.first; };
+		std::sort(byRange.begin(), byRange.end(), bySamples);
+		std::sort(addresses.begin(), addresses.end(), bySamples);
+		auto percent = [this](uint64_t count) {
+			return _total == 0 ? 0.0 : (100.0 * double(count) / double(_total));
+		};
+		auto flags = out.flags();
+		out << "samples: " << _total << " (dropped " << _dropped << ")" << std::endl;
+		out << std::setw(12) << "samples" << std::setw(9) << "percent" << "  range" << std::endl;
+		for (size_t i = 0; i < byRange.size() && i < limit; ++i) {
+			out << std::dec << std::setw(12) << byRange[i].second << std::setw(8) << std::fixed << std::setprecision(2) << percent(byRange[i].second) << "%  " << byRange[i].first << std::endl;
+		}
+		out << std::setw(12) << "samples" << std::setw(9) << "percent" << "  address" << std::endl;
+		for (size_t i = 0; i < addresses.size() && i < limit; ++i) {
+			auto range = rangeOf(addresses[i].first);
+			out << std::dec << std::setw(12) << addresses[i].second << std::setw(8) << std::fixed << std::setprecision(2) << percent(addresses[i].second) << "%  ";
+			out << std::hex << "0x" << std::setw(8) << std::setfill('0') << addresses[i].first << std::setfill(' ');
+			if (!_symbols.empty() && _symbols.lower_bound(addresses[i].first) != _symbols.end()) {
+				// offsets count words into the routine, which runs downward
+				out << " " << range.first << "+0x" << (range.second - addresses[i].first);
+			}
+			out << std::endl;
+		}
+		out.flags(flags);
+	}
+} // end namespace cisc0
@@ -0,0 +1,121 @@
+/**
+ * @file
+ * sampling of the guest instruction pointer
+ * @copyright
+ * cisc0
+ * Copyright (c) 2013-2018, Joshua Scoggins and Contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef _CISC0_PROFILER_H
+#define _CISC0_PROFILER_H
+#include "Core.h"
+#include <atomic>
+#include <map>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+
+namespace cisc0 {
+	/**
+	 * Samples the instruction pointer of a running core without
+	 * instrumenting every instruction. The core records a sample every
+	 * so many instructions and whenever a host profiling timer fires.
+	 * Samples go into a single producer, single consumer ring which a
+	 * collector thread drains into a histogram so the guest thread never
+	 * takes a lock or allocates.
+	 */
+	class Profiler {
+		public:
+			/// number of samples the ring can hold before samples are dropped
+			static constexpr size_t ringCapacity = 1 << 16;
+			/// width of the ranges used when there are no symbols
+			static constexpr Address defaultRangeWidth = 256;
+			/**
+			 * @param interval instructions between samples, zero to only
+			 * sample when the timer fires
+			 */
+			explicit Profiler(Address interval);
+			~Profiler();
+			Address getInterval() const noexcept { return _interval; }
+			/**
+			 * Called by the core before dispatching each instruction
+			 * @return true if a sample should be recorded now
+			 */
+			bool sampleRequested() noexcept {
+				if (_timerExpired.load(std::memory_order_relaxed)) {
+					_timerExpired.store(false, std::memory_order_relaxed);
+					return true;
+				}
+				return false;
+			}
+			/// producer side, never blocks, drops the sample if the ring is full
+			void record(Address pc) noexcept {
+				auto head = _head.load(std::memory_order_relaxed);
+				if (head - _tail.load(std::memory_order_acquire) == ringCapacity) {
+					++_dropped;
+					return;
+				}
+				_ring[head & (ringCapacity - 1)] = pc;
+				_head.store(head + 1, std::memory_order_release);
+			}
+			/**
+			 * Sample whenever the process has used the given slice of cpu
+			 * time, only one profiler may have a timer at a time
+			 */
+			void startTimer(unsigned int hertz);
+			void stopTimer();
+			/// run the consumer on its own thread until stopCollector
+			void startCollector();
+			void stopCollector();
+			/// consumer side, move everything in the ring into the histogram
+			void drain();
+			/**
+			 * Read a map file written by linkcisc0, one hex address and
+			 * symbol name per line
+			 */
+			void loadSymbols(std::istream& in);
+			/**
+			 * Write a flat report sorted by samples, first by symbol (or
+			 * fixed width range without symbols), then by address
+			 * @param limit maximum number of rows in each table
+			 */
+			void report(std::ostream& out, size_t limit = 20);
+		private:
+			/// the symbol covering the given address and where it starts
+			std::pair<std::string, Address> rangeOf(Address addr) const;
+		private:
+			Address _interval;
+			std::unique_ptr<Address[]> _ring;
+			std::atomic<size_t> _head { 0 };
+			std::atomic<size_t> _tail { 0 };
+			std::atomic<bool> _timerExpired { false };
+			std::atomic<bool> _collecting { false };
+			std::thread _collector;
+			uint64_t _dropped = 0;
+			uint64_t _total = 0;
+			std::unordered_map<Address, uint64_t> _histogram;
+			std::map<Address, std::string> _symbols;
+	};
+} // end namespace cisc0
+#endif // end _CISC0_PROFILER_H
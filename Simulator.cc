@@ -24,39 +24,211 @@
  */
 
 #include "Core.h"
+#include "Devices.h"
+#include "InputLog.h"
+#include "Profiler.h"
+#include "Trace.h"
 #include <iostream>
 #include <fstream>
+#include <list>
 
 
 void usage(const std::string& name) {
-	std::cerr << name << ": path-to-installation-image [output-image-path]" << std::endl;
+	std::cerr << name << ": [-e standard|threaded|tiered] [-g] [-s] [-d] [-rom rom-image] [-storage storage-file] [-j statistics.json] [-p sample-interval] [-t sample-hertz] [-m map-file] [-T trace-file] [-record input-log | -replay input-log] path-to-installation-image [output-image-path]" << std::endl;
 }
 using byte = cisc0::byte;
 using Address = cisc0::Address;
 using MemoryWord = cisc0::MemoryWord;
+using ExecutionEngine = cisc0::Core::ExecutionEngine;
 int main(int argc, char** argv) {
 	int exitCode = 0;
 	std::string in, out;
-	switch (argc) {
-		case 0:
-		case 1:
-			usage(argv[0]);
-			return 1;
-		case 3:
-			out = argv[2];
-		case 2:
-			in = argv[1];
-			break;
-		default:
-			usage(argv[0]);
-			return 1;
+	auto engine = ExecutionEngine::Standard;
+	bool findEngine = false;
+	bool printStatistics = false;
+	bool findStatisticsPath = false;
+	std::string statisticsPath;
+	// the option which is waiting on its argument
+	std::string pending;
+	Address sampleInterval = 0;
+	unsigned int sampleHertz = 0;
+	std::string mapPath;
+	std::string tracePath;
+	std::string recordPath, replayPath;
+	bool attachDevices = false;
+	bool guardedMemory = false;
+	std::string romPath;
+	std::string storagePath;
+	std::list<std::string> paths;
+	for (int i = 1; i < argc; ++i) {
+		std::string value = argv[i];
+		if (findEngine) {
+			if (value == "standard") {
+				engine = ExecutionEngine::Standard;
+			} else if (value == "threaded") {
+				engine = ExecutionEngine::Threaded;
+			} else if (value == "tiered") {
+				engine = ExecutionEngine::Tiered;
+			} else {
+				std::cerr << "Unknown execution engine: " << value << std::endl;
+				usage(argv[0]);
+				return 1;
+			}
+			findEngine = false;
+		} else if (!pending.empty()) {
+			if (pending == "-m") {
+				mapPath = value;
+			} else if (pending == "-T") {
+				tracePath = value;
+			} else if (pending == "-rom") {
+				romPath = value;
+				attachDevices = true;
+			} else if (pending == "-storage") {
+				storagePath = value;
+				attachDevices = true;
+			} else if (pending == "-record") {
+				recordPath = value;
+			} else if (pending == "-replay") {
+				replayPath = value;
+			} else {
+				unsigned long number = 0;
+				try {
+					number = std::stoul(value, nullptr, 0);
+				} catch (std::exception&) {
+					std::cerr << "Expected a number after " << pending << ", got: " << value << std::endl;
+					usage(argv[0]);
+					return 1;
+				}
+				if (pending == "-p") {
+					sampleInterval = Address(number);
+				} else {
+					sampleHertz = (unsigned int)number;
+				}
+			}
+			pending.clear();
+		} else if (findStatisticsPath) {
+			statisticsPath = value;
+			findStatisticsPath = false;
+		} else if (value == "-e") {
+			findEngine = true;
+		} else if (value == "-s") {
+			printStatistics = true;
+		} else if (value == "-d") {
+			attachDevices = true;
+		} else if (value == "-g") {
+			guardedMemory = true;
+		} else if (value == "-j") {
+			findStatisticsPath = true;
+		} else if (value == "-p" || value == "-t" || value == "-m" || value == "-T" || value == "-record" || value == "-replay" || value == "-rom" || value == "-storage") {
+			pending = value;
+		} else {
+			paths.emplace_back(value);
+		}
+	}
+	if (findEngine || findStatisticsPath || !pending.empty() || paths.empty() || paths.size() > 2 || (!recordPath.empty() && !replayPath.empty())) {
+		usage(argv[0]);
+		return 1;
+	}
+	in = paths.front();
+	if (paths.size() == 2) {
+		out = paths.back();
 	}
 	std::ifstream input(in.c_str(), std::ios::binary);
 	if (input.is_open()) {
 		// read the first four bytes to find out the size
 		cisc0::Core core (cisc0::readRegisterValue(input));
-		core.install(input);
+		input.close();
+		core.setExecutionEngine(engine);
+		if (guardedMemory) {
+			core.setMemoryBackend(cisc0::Core::MemoryBackend::Guarded);
+		}
+		core.install(in);
+		if (attachDevices) {
+			std::shared_ptr<cisc0::RomDevice> rom;
+			if (!romPath.empty()) {
+				std::ifstream romFile(romPath.c_str(), std::ios::binary);
+				if (!romFile.is_open()) {
+					std::cerr << "Could not open: " << romPath << " for reading!" << std::endl;
+					return 1;
+				}
+				rom = cisc0::RomDevice::read(romFile);
+			}
+			std::shared_ptr<cisc0::SecondaryStorage> storage;
+			if (!storagePath.empty()) {
+				storage = std::make_shared<cisc0::SecondaryStorage>(storagePath);
+			}
+			cisc0::attachStandardDevices(core, rom, storage);
+		}
+		std::unique_ptr<cisc0::Profiler> profiler;
+		if (sampleInterval != 0 || sampleHertz != 0) {
+			profiler = std::make_unique<cisc0::Profiler>(sampleInterval);
+			if (!mapPath.empty()) {
+				std::ifstream map(mapPath.c_str());
+				if (!map.is_open()) {
+					std::cerr << "Could not open: " << mapPath << " for reading!" << std::endl;
+					return 1;
+				}
+				profiler->loadSymbols(map);
+			}
+			core.setProfiler(profiler.get());
+			profiler->startCollector();
+			if (sampleHertz != 0) {
+				profiler->startTimer(sampleHertz);
+			}
+		}
+		std::ofstream recordFile;
+		std::unique_ptr<cisc0::InputLog> inputLog;
+		if (!recordPath.empty()) {
+			recordFile.open(recordPath.c_str());
+			if (!recordFile.is_open()) {
+				std::cerr << "could not open: " << recordPath << " for writing!" << std::endl;
+				return 1;
+			}
+			inputLog = std::make_unique<cisc0::InputLog>(recordFile);
+			core.recordInput(inputLog.get());
+		} else if (!replayPath.empty()) {
+			std::ifstream replayFile(replayPath.c_str());
+			if (!replayFile.is_open()) {
+				std::cerr << "Could not open: " << replayPath << " for reading!" << std::endl;
+				return 1;
+			}
+			// the whole log is read up front so replay never waits on a file
+			inputLog = std::make_unique<cisc0::InputLog>();
+			inputLog->load(replayFile);
+			core.replayInput(inputLog.get());
+		}
+		std::ofstream traceFile;
+		std::unique_ptr<cisc0::TraceWriter> trace;
+		if (!tracePath.empty()) {
+			traceFile.open(tracePath.c_str(), std::ios::binary);
+			if (!traceFile.is_open()) {
+				std::cerr << "could not open: " << tracePath << " for writing!" << std::endl;
+				return 1;
+			}
+			trace = std::make_unique<cisc0::TraceWriter>(traceFile);
+			core.setTrace(trace.get());
+		}
 		core.run();
+		if (trace) {
+			trace->finish();
+		}
+		if (profiler) {
+			profiler->stopTimer();
+			profiler->stopCollector();
+			profiler->report(std::cerr);
+		}
+		if (printStatistics) {
+			core.printStatistics(std::cerr);
+		}
+		if (!statisticsPath.empty()) {
+			std::ofstream file(statisticsPath.c_str());
+			if (!file.is_open()) {
+				std::cerr << "could not open: " << statisticsPath << " for writing!" << std::endl;
+				exitCode = 1;
+			} else {
+				core.writeStatistics(file);
+			}
+		}
 		if (!out.empty()) {
 			std::ofstream file(out.c_str(), std::ios::binary);
 			if (!file.is_open()) {
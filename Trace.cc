@@ -0,0 +1,186 @@
+/**
+ * @file
+ * compact binary instruction traces and their double buffered writer
+ * @copyright
+ * cisc0
+ * Copyright (c) 2013-2018, Joshua Scoggins and Contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "Trace.h"
+#include "Problem.h"
+#include <iostream>
+
+namespace cisc0 {
+	TraceWriter::TraceWriter(std::ostream& out, size_t bufferSize) : _out(out), _bufferSize(bufferSize) {
+		// leave room for the largest record without stores, the stores
+		// are checked as they go in since there can be any number of them
+		_buffers[0] = std::make_unique<byte[]>(bufferSize + slack);
+		_buffers[1] = std::make_unique<byte[]>(bufferSize + slack);
+		_active = _cursor = _buffers[0].get();
+		_out.write(trace::magic, sizeof(trace::magic));
+		_writer = std::thread([this]() { writeLoop(); });
+	}
+	TraceWriter::~TraceWriter() {
+		finish();
+	}
+	void TraceWriter::endInstruction(RegisterIndex destination, Address value) {
+		auto storeCount = _stores.size();
+		byte header = _length & trace::lengthMask;
+		if (_pc != _expectedPC) {
+			header |= trace::jumpFlag;
+		}
+		header |= byte((storeCount < trace::storeCountEscape ? storeCount : trace::storeCountEscape) << trace::storeShift);
+		put(header);
+		if (storeCount >= trace::storeCountEscape) {
+			putVarint(uint32_t(storeCount));
+		}
+		if (_pc != _expectedPC) {
+			putVarint(trace::zigzag(Integer(_pc - _expectedPC)));
+		}
+		for (byte i = 0; i < _length; ++i) {
+			putWord(_words[i]);
+		}
+		auto& last = _registers[destination & 0x0F];
+		putVarint(trace::zigzag(Integer(value - last)));
+		last = value;
+		for (auto& store : _stores) {
+			if (size_t(_cursor - _active) >= _bufferSize + slack - maximumStoreLength) {
+				handOff();
+			}
+			putVarint(trace::zigzag(Integer(store.first - _lastStore)));
+			putWord(store.second);
+			_lastStore = store.first;
+		}
+		// instructions are laid out walking downward
+		_expectedPC = _pc - _length;
+		++_records;
+		if (size_t(_cursor - _active) >= _bufferSize) {
+			handOff();
+		}
+	}
+	void TraceWriter::handOff() {
+		std::unique_lock<std::mutex> guard(_lock);
+		// only wait if the writer is still busy with the other buffer
+		_ready.wait(guard, [this]() { return _full == nullptr; });
+		_full = _active;
+		_fullLength = size_t(_cursor - _active);
+		_active = _cursor = (_active == _buffers[0].get()) ? _buffers[1].get() : _buffers[0].get();
+		_ready.notify_all();
+	}
+	void TraceWriter::writeLoop() {
+		std::unique_lock<std::mutex> guard(_lock);
+		while (true) {
+			_ready.wait(guard, [this]() { return _full != nullptr || _done; });
+			if (_full) {
+				auto buffer = _full;
+				auto length = _fullLength;
+				guard.unlock();
+				_out.write(reinterpret_cast<const char*>(buffer), std::streamsize(length));
+				guard.lock();
+				_full = nullptr;
+				_ready.notify_all();
+			} else if (_done) {
+				return;
+			}
+		}
+	}
+	void TraceWriter::finish() {
+		if (!_writer.joinable()) {
+			return;
+		}
+		if (_cursor != _active) {
+			handOff();
+		}
+		{
+			std::unique_lock<std::mutex> guard(_lock);
+			_done = true;
+			_ready.notify_all();
+		}
+		_writer.join();
+		_out.flush();
+	}
+
+	TraceReader::TraceReader(std::istream& in) : _in(in) {
+		char header[sizeof(trace::magic)] = { 0 };
+		_in.read(header, sizeof(header));
+		if (!_in || !std::equal(header, header + sizeof(header), trace::magic)) {
+			throw Problem("Not a cisc0 trace!");
+		}
+	}
+	uint32_t TraceReader::getVarint() {
+		uint32_t value = 0;
+		for (int shift = 0; shift < 35; shift += 7) {
+			auto c = _in.get();
+			if (c == std::char_traits<char>::eof()) {
+				throw Problem("Trace ends in the middle of a record!");
+			}
+			value |= uint32_t(c & 0x7F) << shift;
+			if ((c & 0x80) == 0) {
+				return value;
+			}
+		}
+		throw Problem("Malformed varint in trace!");
+	}
+	MemoryWord TraceReader::getWord() {
+		auto lower = _in.get();
+		auto upper = _in.get();
+		if (upper == std::char_traits<char>::eof()) {
+			throw Problem("Trace ends in the middle of a record!");
+		}
+		return MemoryWord(lower | (upper << 8));
+	}
+	bool TraceReader::next(Record& record) {
+		auto header = _in.get();
+		if (header == std::char_traits<char>::eof()) {
+			return false;
+		}
+		record._length = byte(header) & trace::lengthMask;
+		if (record._length == 0) {
+			throw Problem("Trace record without any instruction words!");
+		}
+		Address storeCount = byte(header) >> trace::storeShift;
+		if (storeCount == trace::storeCountEscape) {
+			storeCount = getVarint();
+		}
+		record._pc = _expectedPC;
+		if (header & trace::jumpFlag) {
+			record._pc += Address(trace::unzigzag(getVarint()));
+		}
+		for (byte i = 0; i < 3; ++i) {
+			record._words[i] = i < record._length ? getWord() : 0;
+		}
+		record._destination = Core::Instruction::fromFirstWord(record._words[0]).getDestination();
+		auto& last = _registers[record._destination];
+		last += Address(trace::unzigzag(getVarint()));
+		record._destinationValue = last;
+		record._stores.clear();
+		for (Address i = 0; i < storeCount; ++i) {
+			_lastStore += Address(trace::unzigzag(getVarint()));
+			record._stores.emplace_back(_lastStore, getWord());
+		}
+		// instructions are laid out walking downward
+		_expectedPC = record._pc - record._length;
+		return true;
+	}
+} // end namespace cisc0
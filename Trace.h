@@ -0,0 +1,168 @@
+/**
+ * @file
+ * compact binary instruction traces and their double buffered writer
+ * @copyright
+ * cisc0
+ * Copyright (c) 2013-2018, Joshua Scoggins and Contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef _CISC0_TRACE_H
+#define _CISC0_TRACE_H
+#include "Core.h"
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cisc0 {
+	/**
+	 * Layout of a trace: the magic bytes followed by one record per
+	 * retired instruction. Each record is
+	 *
+	 * - a header byte: instruction length in words (bits 0-1), whether
+	 *   the pc is somewhere other than just past the previous instruction,
+	 *   such as after a taken branch (bit 2), and the number of stores (bits 3-7, 31 means a varint
+	 *   count follows)
+	 * - if the pc jumped, the zigzag varint delta from where it was expected
+	 * - the raw instruction words, little endian
+	 * - the zigzag varint delta of the destination register against the
+	 *   last value recorded for that register
+	 * - for each store, the zigzag varint delta of its address against the
+	 *   previous store and the word stored, little endian
+	 *
+	 * Registers and the previous store address start out at zero.
+	 */
+	namespace trace {
+		constexpr char magic[4] = { 'c', '0', 't', 'r' };
+		constexpr byte lengthMask = 0b11;
+		constexpr byte jumpFlag = 0b100;
+		constexpr byte storeShift = 3;
+		constexpr byte storeCountEscape = 0b11111;
+		constexpr uint32_t zigzag(Integer value) noexcept {
+			return (uint32_t(value) << 1) ^ uint32_t(value >> 31);
+		}
+		constexpr Integer unzigzag(uint32_t value) noexcept {
+			return Integer(value >> 1) ^ -Integer(value & 1);
+		}
+	} // end namespace trace
+	/**
+	 * Encodes retired instructions on the guest thread and hands full
+	 * buffers to a writer thread. There are two buffers so the guest only
+	 * waits when it fills one before the other has hit the stream.
+	 */
+	class TraceWriter {
+		public:
+			static constexpr size_t defaultBufferSize = 1 << 20;
+			/// header, store count, pc, three words, and a register
+			static constexpr size_t slack = 1 + 5 + 5 + 6 + 5;
+			static constexpr size_t maximumStoreLength = 5 + 2;
+			TraceWriter(std::ostream& out, size_t bufferSize = defaultBufferSize);
+			~TraceWriter();
+			/// called before the instruction is carried out
+			void beginInstruction(Address pc, const MemoryWord* words, byte length) noexcept {
+				_pc = pc;
+				_words[0] = words[0];
+				_words[1] = words[1];
+				_words[2] = words[2];
+				_length = length;
+				_stores.clear();
+			}
+			void noteStore(Address addr, MemoryWord value) {
+				_stores.emplace_back(addr, value);
+			}
+			/// called once the instruction is done
+			void endInstruction(RegisterIndex destination, Address value);
+			/// push everything buffered so far out to the stream and stop the writer
+			void finish();
+			uint64_t getRecordCount() const noexcept { return _records; }
+		private:
+			void put(byte value) noexcept { *_cursor++ = value; }
+			void putWord(MemoryWord value) noexcept {
+				put(byte(value));
+				put(byte(value >> 8));
+			}
+			void putVarint(uint32_t value) noexcept {
+				while (value >= 0x80) {
+					put(byte(value | 0x80));
+					value >>= 7;
+				}
+				put(byte(value));
+			}
+			/// give the active buffer to the writer thread and take the idle one
+			void handOff();
+			void writeLoop();
+		private:
+			std::ostream& _out;
+			size_t _bufferSize;
+			std::unique_ptr<byte[]> _buffers[2];
+			/// the buffer being filled and where the next byte goes in it
+			byte* _active;
+			byte* _cursor;
+			/// the buffer waiting on the writer thread, if any
+			byte* _full = nullptr;
+			size_t _fullLength = 0;
+			bool _done = false;
+			std::mutex _lock;
+			std::condition_variable _ready;
+			std::thread _writer;
+			// state of the record being built
+			Address _pc = 0;
+			MemoryWord _words[3] = { 0 };
+			byte _length = 0;
+			std::vector<std::pair<Address, MemoryWord>> _stores;
+			// what the deltas are taken against
+			Address _expectedPC = 0;
+			Address _registers[Core::ArchitectureConstants::RegisterCount] = { 0 };
+			Address _lastStore = 0;
+			uint64_t _records = 0;
+	};
+	/**
+	 * Decodes a trace written by TraceWriter one record at a time
+	 */
+	class TraceReader {
+		public:
+			struct Record {
+				Address _pc;
+				MemoryWord _words[3];
+				byte _length;
+				RegisterIndex _destination;
+				Address _destinationValue;
+				std::vector<std::pair<Address, MemoryWord>> _stores;
+			};
+			/// checks the magic bytes up front
+			explicit TraceReader(std::istream& in);
+			/// @return false once the trace is exhausted
+			bool next(Record& record);
+		private:
+			uint32_t getVarint();
+			MemoryWord getWord();
+		private:
+			std::istream& _in;
+			Address _expectedPC = 0;
+			Address _registers[Core::ArchitectureConstants::RegisterCount] = { 0 };
+			Address _lastStore = 0;
+	};
+} // end namespace cisc0
+#endif // end _CISC0_TRACE_H
@@ -0,0 +1,137 @@
+/*
+ * cisc0
+ * Copyright (c) 2013-2018, Joshua Scoggins and Contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "Core.h"
+#include "Trace.h"
+#include "Problem.h"
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+void usage(const std::string& name) {
+	std::cerr << name << ": [-r low:high] [-k kind] [-s address] [-n count] trace-file" << std::endl;
+	std::cerr << "\t-r only records whose pc is within low to high inclusive" << std::endl;
+	std::cerr << "\t-k only records of the given kind, e.g. MemoryStore" << std::endl;
+	std::cerr << "\t-s only records which store to the given address" << std::endl;
+	std::cerr << "\t-n stop after printing count records" << std::endl;
+}
+using Address = cisc0::Address;
+using Core = cisc0::Core;
+int main(int argc, char** argv) {
+	Address low = 0, high = ~Address(0);
+	std::string kind;
+	bool filterStore = false;
+	Address storeAddress = 0;
+	uint64_t limit = ~uint64_t(0);
+	std::string path, pending;
+	try {
+		for (int i = 1; i < argc; ++i) {
+			std::string value = argv[i];
+			if (pending == "-r") {
+				auto colon = value.find(':');
+				if (colon == std::string::npos) {
+					std::cerr << "Expected low:high after -r, got: " << value << std::endl;
+					usage(argv[0]);
+					return 1;
+				}
+				low = Address(std::stoul(value.substr(0, colon), nullptr, 0));
+				high = Address(std::stoul(value.substr(colon + 1), nullptr, 0));
+			} else if (pending == "-k") {
+				kind = value;
+			} else if (pending == "-s") {
+				filterStore = true;
+				storeAddress = Address(std::stoul(value, nullptr, 0));
+			} else if (pending == "-n") {
+				limit = std::stoull(value, nullptr, 0);
+			} else if (value == "-r" || value == "-k" || value == "-s" || value == "-n") {
+				pending = value;
+				continue;
+			} else if (path.empty()) {
+				path = value;
+			} else {
+				usage(argv[0]);
+				return 1;
+			}
+			pending.clear();
+		}
+	} catch (std::exception&) {
+		std::cerr << "Expected a number after " << pending << std::endl;
+		usage(argv[0]);
+		return 1;
+	}
+	if (path.empty() || !pending.empty()) {
+		usage(argv[0]);
+		return 1;
+	}
+	std::ifstream in(path.c_str(), std::ios::binary);
+	if (!in.is_open()) {
+		std::cerr << "Could not open: " << path << " for reading!" << std::endl;
+		return 1;
+	}
+	uint64_t index = 0, printed = 0;
+	try {
+		cisc0::TraceReader reader(in);
+		cisc0::TraceReader::Record record;
+		std::cout << std::hex << std::setfill('0');
+		for (; printed < limit && reader.next(record); ++index) {
+			if (record._pc < low || record._pc > high) {
+				continue;
+			}
+			auto name = Core::getKindName(Core::Instruction::fromFirstWord(record._words[0]).getKind());
+			if (!kind.empty() && kind != name) {
+				continue;
+			}
+			if (filterStore) {
+				bool found = false;
+				for (auto& store : record._stores) {
+					found = found || store.first == storeAddress;
+				}
+				if (!found) {
+					continue;
+				}
+			}
+			std::cout << std::dec << index << std::hex << " 0x" << std::setw(8) << record._pc;
+			for (cisc0::byte i = 0; i < 3; ++i) {
+				if (i < record._length) {
+					std::cout << " " << std::setw(4) << record._words[i];
+				} else {
+					std::cout << "     ";
+				}
+			}
+			std::cout << " " << name << " r" << std::dec << int(record._destination) << std::hex << "=0x" << std::setw(8) << record._destinationValue;
+			for (auto& store : record._stores) {
+				std::cout << " [0x" << std::setw(8) << store.first << "]=0x" << std::setw(4) << store.second;
+			}
+			std::cout << std::endl;
+			++printed;
+		}
+	} catch (cisc0::Problem& p) {
+		std::cout.flush();
+		std::cerr << p.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,255 @@
+/*
+ * cisc0
+ * Copyright (c) 2013-2018, Joshua Scoggins and Contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Core.h"
+#include "Channel.h"
+#include "Devices.h"
+#include "InputLog.h"
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+void usage(const std::string& name) {
+	std::cerr << name << ": [-e standard|threaded|tiered] workload-directory" << std::endl;
+	std::cerr << "the directory holds an expected file with a name and dump hash per line along with name.img and optionally name.in" << std::endl;
+	std::cerr << "workloads with input are run a second time replaying what they read, which has to produce the same dump" << std::endl;
+	std::cerr << "a storage.img is run against a scratch storage.disk and has to leave its block behind in the file" << std::endl;
+}
+using ExecutionEngine = cisc0::Core::ExecutionEngine;
+/**
+ * Computes the 64-bit FNV-1a hash of everything written to it so full
+ * dumps can be checked without keeping them around
+ */
+class HashBuffer : public std::streambuf {
+	public:
+		uint64_t getHash() const noexcept { return _hash; }
+	protected:
+		int_type overflow(int_type ch) override {
+			if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+				add(char(ch));
+			}
+			return traits_type::not_eof(ch);
+		}
+		std::streamsize xsputn(const char* s, std::streamsize count) override {
+			for (std::streamsize i = 0; i < count; ++i) {
+				add(s[i]);
+			}
+			return count;
+		}
+	private:
+		void add(char c) noexcept {
+			_hash ^= uint64_t(cisc0::byte(c));
+			_hash *= 0x100000001b3;
+		}
+	private:
+		uint64_t _hash = 0xcbf29ce484222325;
+};
+/// a core with the image installed, the capacity comes from the image itself
+std::unique_ptr<cisc0::Core> load(const std::string& imagePath, ExecutionEngine engine) {
+	std::ifstream image(imagePath.c_str(), std::ios::binary);
+	if (!image.is_open()) {
+		throw cisc0::Problem("Could not open: " + imagePath + " for reading!");
+	}
+	auto core = std::make_unique<cisc0::Core>(cisc0::readRegisterValue(image));
+	image.close();
+	core->setExecutionEngine(engine);
+	core->install(imagePath);
+	core->setOutput(std::make_shared<cisc0::DiscardOutput>());
+	return core;
+}
+uint64_t hashDump(cisc0::Core& core) {
+	HashBuffer dump;
+	std::ostream out(&dump);
+	core.dump(out);
+	return dump.getHash();
+}
+/**
+ * Run the storage workload a number of times, each run writes a block and
+ * terminates without waiting on the transfer so the block has to make it
+ * into the file while the storage is being torn down
+ */
+bool checkStorage(const std::string& directory, ExecutionEngine engine) {
+	constexpr int runs = 64;
+	auto imagePath = directory + "/storage.img";
+	auto diskPath = directory + "/storage.disk";
+	for (int run = 0; run < runs; ++run) {
+		std::remove(diskPath.c_str());
+		{
+			auto storage = std::make_shared<cisc0::SecondaryStorage>(diskPath, 1);
+			auto core = load(imagePath, engine);
+			cisc0::attachStandardDevices(*core, nullptr, storage);
+			core->run();
+		}
+		std::ifstream disk(diskPath.c_str(), std::ios::binary);
+		char pair[2];
+		for (cisc0::Address i = 0; i < cisc0::SecondaryStorage::blockSize; ++i) {
+			if (!disk.read(pair, 2)) {
+				std::cerr << "storage: could not read back " << diskPath << "!" << std::endl;
+				return false;
+			}
+			auto word = cisc0::MemoryWord(cisc0::byte(pair[0])) | (cisc0::MemoryWord(cisc0::byte(pair[1])) << 8);
+			if (word != cisc0::MemoryWord(0x1234 + i)) {
+				std::cerr << "storage: run " << run << " lost the block written right before terminating!" << std::endl;
+				return false;
+			}
+		}
+	}
+	std::remove(diskPath.c_str());
+	return true;
+}
+struct Result {
+	std::string _name;
+	double _seconds = 0;
+	uint64_t _instructions = 0;
+	bool _matches = false;
+};
+int main(int argc, char** argv) {
+	auto engine = ExecutionEngine::Standard;
+	std::string directory;
+	for (int i = 1; i < argc; ++i) {
+		std::string value = argv[i];
+		if (value == "-e" && i + 1 < argc) {
+			std::string name = argv[++i];
+			if (name == "standard") {
+				engine = ExecutionEngine::Standard;
+			} else if (name == "threaded") {
+				engine = ExecutionEngine::Threaded;
+			} else if (name == "tiered") {
+				engine = ExecutionEngine::Tiered;
+			} else {
+				std::cerr << "Unknown execution engine: " << name << std::endl;
+				usage(argv[0]);
+				return 1;
+			}
+		} else if (directory.empty()) {
+			directory = value;
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (directory.empty()) {
+		usage(argv[0]);
+		return 1;
+	}
+	auto expectedPath = directory + "/expected";
+	std::ifstream expected(expectedPath.c_str());
+	if (!expected.is_open()) {
+		std::cerr << "Could not open: " << expectedPath << " for reading!" << std::endl;
+		return 1;
+	}
+	std::vector<Result> results;
+	int exitCode = 0;
+	std::string name;
+	uint64_t hash = 0;
+	while (expected >> name >> std::hex >> hash) {
+		Result result;
+		result._name = name;
+		auto imagePath = directory + "/" + name + ".img";
+		cisc0::InputLog recorded;
+		bool readsInput = true;
+		uint64_t actual = 0;
+		try {
+			auto core = load(imagePath, engine);
+			try {
+				core->setInput(cisc0::DescriptorInput::open(directory + "/" + name + ".in"));
+				core->recordInput(&recorded);
+			} catch (cisc0::Problem&) {
+				// most workloads don't read anything
+				core->setInput(std::make_shared<cisc0::MemoryInput>(""));
+				readsInput = false;
+			}
+			auto start = std::chrono::steady_clock::now();
+			core->run();
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			result._seconds = elapsed.count();
+			result._instructions = core->getStatistics().getInstructionCount();
+			actual = hashDump(*core);
+		} catch (cisc0::Problem& p) {
+			std::cerr << name << ": " << p.what() << std::endl;
+			return 1;
+		}
+		result._matches = actual == hash;
+		if (!result._matches) {
+			std::cerr << name << ": dump " << std::hex << actual << " does not match the expected " << hash << std::dec << "!" << std::endl;
+			exitCode = 1;
+		}
+		if (readsInput) {
+			// the log goes through its text form so every kind of event is
+			// written out and parsed back before being replayed
+			std::stringstream text;
+			recorded.save(text);
+			cisc0::InputLog replay;
+			uint64_t replayed = 0;
+			try {
+				replay.load(text);
+				auto core = load(imagePath, engine);
+				core->setInput(std::make_shared<cisc0::MemoryInput>(""));
+				core->replayInput(&replay);
+				core->run();
+				replayed = hashDump(*core);
+			} catch (cisc0::Problem& p) {
+				std::cerr << name << ": replay failed: " << p.what() << std::endl;
+				return 1;
+			}
+			if (replayed != actual || !replay.exhausted()) {
+				std::cerr << name << ": replaying the recorded input gave dump " << std::hex << replayed << " instead of " << actual << std::dec << "!" << std::endl;
+				result._matches = false;
+				exitCode = 1;
+			}
+		}
+		results.emplace_back(result);
+	}
+	if (std::ifstream(directory + "/storage.img").is_open()) {
+		try {
+			if (!checkStorage(directory, engine)) {
+				exitCode = 1;
+			}
+		} catch (cisc0::Problem& p) {
+			std::cerr << "storage: " << p.what() << std::endl;
+			return 1;
+		}
+	}
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << "{" << std::endl;
+	std::cout << "\t\"workloads\": [" << std::endl;
+	for (size_t i = 0; i < results.size(); ++i) {
+		auto& result = results[i];
+		std::cout << "\t\t{ \"name\": \"" << result._name << "\", \"seconds\": " << result._seconds;
+		std::cout << ", \"instructions\": " << result._instructions;
+		std::cout << ", \"mips\": " << (result._seconds > 0 ? double(result._instructions) / result._seconds / 1.0e6 : 0.0);
+		std::cout << ", \"matches\": " << (result._matches ? "true" : "false") << " }";
+		std::cout << (i + 1 < results.size() ? "," : "") << std::endl;
+	}
+	std::cout << "\t]" << std::endl;
+	std::cout << "}" << std::endl;
+	return exitCode;
+}
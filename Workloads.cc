@@ -0,0 +1,538 @@
+/*
+ * cisc0
+ * Copyright (c) 2013-2018, Joshua Scoggins and Contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Core.h"
+#include "Devices.h"
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using byte = cisc0::byte;
+using Address = cisc0::Address;
+using MemoryWord = cisc0::MemoryWord;
+using RegisterIndex = cisc0::RegisterIndex;
+using Core = cisc0::Core;
+using Op = Core::OperationCode;
+using Constants = Core::ArchitectureConstants;
+
+void usage(const std::string& name) {
+	std::cerr << name << ": output-directory" << std::endl;
+}
+/**
+ * Just enough of an assembler to lay out the workloads. Code is placed
+ * walking downward through memory just like the instruction pointer
+ * does, branch targets may be used before they are defined.
+ */
+class Assembler {
+	public:
+		static constexpr byte fullMask = 0b1111;
+		Assembler(Address start) : _here(start) {
+			setRegister(Constants::InstructionPointer, start);
+		}
+		void setRegister(RegisterIndex index, Address value) {
+			_registers[index] = value;
+		}
+		void label(const std::string& name) {
+			_labels[name] = _here;
+		}
+		void data(Address addr, MemoryWord value) {
+			_words.emplace_back(addr, value);
+		}
+		/// length prefixed string in the layout loadString expects
+		void string(Address addr, const std::string& value) {
+			data(addr, MemoryWord(value.size()));
+			data(addr + 1, MemoryWord(value.size() >> 16));
+			for (Address i = 0; i < value.size(); ++i) {
+				data(addr + 2 + i, MemoryWord(value[i]));
+			}
+		}
+		void arithmetic(Core::ArithmeticStyle style, RegisterIndex dest, RegisterIndex src) {
+			emit(Op::Arithmetic, byte(style) << 5, src, dest);
+		}
+		void arithmeticImmediate(Core::ArithmeticStyle style, RegisterIndex dest, Address value) {
+			emitImmediate(Op::Arithmetic, byte(style) << 5, dest, value);
+		}
+		void logical(Core::LogicalStyle style, RegisterIndex dest, RegisterIndex src) {
+			emit(Op::Logical, byte(style) << 5, src, dest);
+		}
+		void shiftImmediate(bool left, RegisterIndex dest, byte amount) {
+			word(MemoryWord(byte(Op::Shift) | 0b1'0000 | (left ? 0b10'0000 : 0) | ((amount & 0b11111) << 7) | (dest << 12)));
+		}
+		void compare(Core::CompareStyle style, RegisterIndex dest, RegisterIndex src) {
+			emit(Op::Compare, byte(style) << 5, src, dest);
+		}
+		void compareImmediate(Core::CompareStyle style, RegisterIndex dest, Address value) {
+			emitImmediate(Op::Compare, byte(style) << 5, dest, value);
+		}
+		void moveFromCondition(RegisterIndex dest) {
+			emit(Op::Compare, byte(Core::CompareStyle::MoveFromCondition) << 5, 0, dest);
+		}
+		/// dest = value, set never reads an immediate so build it with arithmetic
+		void constant(RegisterIndex dest, Address value) {
+			logical(Core::LogicalStyle::Xor, dest, dest);
+			if (value != 0) {
+				arithmeticImmediate(Core::ArithmeticStyle::Add, dest, value);
+			}
+		}
+		/// dest = src
+		void copy(RegisterIndex dest, RegisterIndex src) {
+			logical(Core::LogicalStyle::Xor, dest, dest);
+			arithmetic(Core::ArithmeticStyle::Add, dest, src);
+		}
+		void branch(const std::string& target, bool call = false, bool conditional = false) {
+			word(MemoryWord(byte(Op::Branch) | 0b1'0000 | (call ? 0b10'0000 : 0) | (conditional ? 0b100'0000 : 0)));
+			// the upper half of the target comes first
+			_fixups.emplace_back(_here, target);
+			word(0);
+			word(0);
+		}
+		void call(const std::string& target) { branch(target, true); }
+		void branchIf(const std::string& target) { branch(target, false, true); }
+		void load(byte offset, byte mask) { memory(Core::MemoryStyle::Load, mask, offset); }
+		void store(byte offset, byte mask) { memory(Core::MemoryStyle::Store, mask, offset); }
+		void push(RegisterIndex reg, byte mask = fullMask) { memory(Core::MemoryStyle::Push, mask, reg); }
+		void pop(RegisterIndex reg, byte mask = fullMask) { memory(Core::MemoryStyle::Pop, mask, reg); }
+		void set(RegisterIndex dest, byte mask = fullMask) { emit(Op::Set, 0, mask, dest); }
+		void swap(RegisterIndex dest, RegisterIndex src) { emit(Op::Swap, 0, src, dest); }
+		void misc(Core::MiscStyle style, RegisterIndex dest = 0, RegisterIndex src = 0) {
+			emit(Op::Misc, byte(style) << 4, src, dest);
+		}
+		/// the block operations take their word count from the value register
+		void block(Core::BlockStyle style, RegisterIndex dest, RegisterIndex src) {
+			emit(Op::Block, byte(style) << 4, src, dest);
+		}
+		void ret() { misc(Core::MiscStyle::Return); }
+		void terminate() { misc(Core::MiscStyle::Terminate); }
+		/**
+		 * Write out the linkcisc0 object, one entry of section, address,
+		 * and value per word, register, or symbol character
+		 */
+		void write(std::ostream& out) {
+			for (auto& fixup : _fixups) {
+				auto target = _labels.find(fixup.second);
+				if (target == _labels.end()) {
+					throw cisc0::Problem("undefined label " + fixup.second);
+				}
+				data(fixup.first, MemoryWord(target->second >> 16));
+				data(fixup.first - 1, MemoryWord(target->second));
+			}
+			for (auto& reg : _registers) {
+				// registers are installed with the index in the value field
+				entry(out, 1, reg.second, reg.first);
+			}
+			for (auto& w : _words) {
+				entry(out, 2, w.first, w.second);
+			}
+			for (auto& l : _labels) {
+				// symbols are spelled out a character per entry
+				for (auto c : l.first) {
+					entry(out, 3, l.second, MemoryWord(c));
+				}
+				entry(out, 3, l.second, 0);
+			}
+		}
+	private:
+		void word(MemoryWord value) {
+			data(_here--, value);
+		}
+		void emit(Op op, byte styleBits, byte field, RegisterIndex dest) {
+			word(MemoryWord(byte(op) | styleBits | ((field & 0xF) << 8) | ((dest & 0xF) << 12)));
+		}
+		void emitImmediate(Op op, byte styleBits, RegisterIndex dest, Address value) {
+			emit(op, styleBits | 0b1'0000, fullMask, dest);
+			word(MemoryWord(value));
+			word(MemoryWord(value >> 16));
+		}
+		void memory(Core::MemoryStyle style, byte mask, byte field) {
+			emit(Op::Memory, byte(style) << 5, mask, field);
+		}
+		static void entry(std::ostream& out, MemoryWord section, Address address, MemoryWord value) {
+			auto put = [&out](MemoryWord w) {
+				out.put(char(w));
+				out.put(char(w >> 8));
+			};
+			put(section);
+			put(MemoryWord(address));
+			put(MemoryWord(address >> 16));
+			put(value);
+		}
+	private:
+		Address _here;
+		std::map<RegisterIndex, Address> _registers;
+		std::map<std::string, Address> _labels;
+		std::list<std::pair<Address, std::string>> _fixups;
+		std::vector<std::pair<Address, MemoryWord>> _words;
+};
+using A = Core::ArithmeticStyle;
+using C = Core::CompareStyle;
+using L = Core::LogicalStyle;
+using B = Core::BlockStyle;
+constexpr Address codeStart = 0x8000;
+constexpr RegisterIndex AR = Constants::AddressRegister;
+constexpr RegisterIndex VR = Constants::ValueRegister;
+Assembler start() {
+	Assembler a(codeStart);
+	a.setRegister(Constants::StackPointer, 0xF00000);
+	a.setRegister(Constants::CallStackPointer, 0xE00000);
+	a.label("start");
+	return a;
+}
+/// mixed register arithmetic in a counted loop
+Assembler arithmetic() {
+	auto a = start();
+	a.constant(0, 0);
+	a.constant(1, 1);
+	a.constant(2, 7);
+	a.label("loop");
+	a.arithmeticImmediate(A::Add, 0, 1);
+	a.arithmetic(A::Add, 1, 0);
+	a.arithmeticImmediate(A::Mul, 2, 3);
+	a.logical(L::Xor, 2, 1);
+	a.arithmeticImmediate(A::Rem, 2, 65521);
+	a.shiftImmediate(true, 1, 1);
+	a.arithmetic(A::Sub, 1, 2);
+	a.compareImmediate(C::LessThan, 0, 500000);
+	a.branchIf("loop");
+	a.terminate();
+	return a;
+}
+/// naive recursive fibonacci, every call goes through the call stack
+Assembler recursion() {
+	auto a = start();
+	a.constant(0, 24);
+	a.call("fib");
+	a.terminate();
+	// r0 holds n, the result comes back in r1
+	a.label("fib");
+	a.compareImmediate(C::LessThan, 0, 2);
+	a.branchIf("base");
+	a.push(0);
+	a.arithmeticImmediate(A::Sub, 0, 1);
+	a.call("fib");
+	a.pop(0);
+	a.push(1);
+	a.arithmeticImmediate(A::Sub, 0, 2);
+	a.call("fib");
+	a.pop(2);
+	a.arithmetic(A::Add, 1, 2);
+	a.ret();
+	a.label("base");
+	a.copy(1, 0);
+	a.ret();
+	return a;
+}
+/// masked loads and stores walking over an array
+Assembler memory() {
+	constexpr Address base = 0x40000;
+	auto a = start();
+	a.constant(7, 0);
+	a.label("pass");
+	a.constant(0, 0);
+	a.label("loop");
+	a.constant(AR, base);
+	a.arithmetic(A::Add, AR, 0);
+	a.load(0, 0b0011);
+	a.arithmetic(A::Add, VR, 0);
+	a.arithmeticImmediate(A::Mul, VR, 3);
+	a.store(0, 0b0001);
+	a.store(2, 0b1100);
+	a.load(2, 0b1111);
+	a.arithmetic(A::Add, 3, VR);
+	a.store(4, 0b0110);
+	// set of the address register followed by a load, the fusable pair
+	a.set(AR);
+	a.load(3, 0b0011);
+	a.arithmetic(A::Add, 3, VR);
+	a.arithmeticImmediate(A::Add, 0, 1);
+	a.compareImmediate(C::LessThan, 0, 4096);
+	a.branchIf("loop");
+	a.arithmeticImmediate(A::Add, 7, 1);
+	a.compareImmediate(C::LessThan, 7, 16);
+	a.branchIf("pass");
+	a.terminate();
+	return a;
+}
+/// copy and compare strings over and over
+Assembler strings() {
+	constexpr Address source = 0x30000;
+	constexpr Address other = 0x30100;
+	constexpr Address destination = 0x31000;
+	auto a = start();
+	a.string(source, "the quick brown fox jumps over the lazy dog");
+	a.string(other, "the quick brown fox jumps over the lazy cat");
+	a.constant(1, source);
+	a.constant(2, destination);
+	a.constant(3, other);
+	a.constant(0, 0);
+	a.constant(5, 0);
+	a.label("loop");
+	a.misc(Core::MiscStyle::StringCopy, 2, 1);
+	a.misc(Core::MiscStyle::StringEquals, 2, 1);
+	a.moveFromCondition(6);
+	a.arithmetic(A::Add, 5, 6);
+	a.misc(Core::MiscStyle::StringEquals, 2, 3);
+	a.moveFromCondition(6);
+	a.arithmetic(A::Add, 5, 6);
+	a.misc(Core::MiscStyle::StringCopy, 2, 3);
+	a.arithmeticImmediate(A::Add, 0, 1);
+	a.compareImmediate(C::LessThan, 0, 20000);
+	a.branchIf("loop");
+	a.terminate();
+	return a;
+}
+/// fill, copy, compare, and search large word ranges
+Assembler blocks() {
+	constexpr Address source = 0x40000;
+	constexpr Address destination = 0x48000;
+	constexpr Address length = 0x2000;
+	auto a = start();
+	a.constant(1, source);
+	a.constant(2, destination);
+	a.constant(3, destination + 1);
+	a.constant(4, destination + 0x1234);
+	a.constant(7, 0xBEEF);
+	a.constant(0, 0);
+	a.constant(5, 0);
+	a.label("loop");
+	a.constant(VR, length);
+	a.block(B::Fill, 1, 0);
+	a.block(B::Copy, 2, 1);
+	a.block(B::Compare, 2, 1);
+	a.moveFromCondition(6);
+	a.arithmetic(A::Add, 5, 6);
+	// slide the copy up a word over itself
+	a.constant(VR, length - 1);
+	a.block(B::Copy, 3, 2);
+	a.constant(VR, 1);
+	a.block(B::Fill, 4, 7);
+	a.copy(8, 2);
+	a.constant(VR, length);
+	a.block(B::Search, 8, 7);
+	a.moveFromCondition(6);
+	a.arithmetic(A::Add, 5, 6);
+	a.arithmetic(A::Add, 5, 8);
+	a.arithmeticImmediate(A::Add, 0, 1);
+	a.compareImmediate(C::LessThan, 0, 2000);
+	a.branchIf("loop");
+	a.terminate();
+	return a;
+}
+/**
+ * An outer interpreter in the style of Forth, words are read with ReadWord
+ * and looked up in a tiny dictionary, the parameter stack is the data
+ * stack. Runs until it sees bye or an unknown word.
+ */
+Assembler forth() {
+	constexpr Address buffer = 0x20000;
+	constexpr Address dictionary = 0x21000;
+	const char* words[] = { "one", "dup", "add", "drop", "swap", "bye" };
+	auto a = start();
+	for (Address i = 0; i < 6; ++i) {
+		a.string(dictionary + i * 0x10, words[i]);
+		a.constant(3 + i, dictionary + i * 0x10);
+	}
+	a.constant(1, buffer);
+	a.constant(2, 15);
+	a.label("next");
+	a.misc(Core::MiscStyle::ReadWord, 1, 2);
+	for (Address i = 0; i < 6; ++i) {
+		a.misc(Core::MiscStyle::StringEquals, 1, 3 + i);
+		a.branchIf(std::string("do-") + words[i]);
+	}
+	// unknown or no more input
+	a.terminate();
+	a.label("do-one");
+	a.constant(0, 1);
+	a.push(0);
+	a.branch("next");
+	a.label("do-dup");
+	a.pop(0);
+	a.push(0);
+	a.push(0);
+	a.branch("next");
+	a.label("do-add");
+	a.pop(0);
+	a.pop(9);
+	a.arithmetic(A::Add, 0, 9);
+	a.push(0);
+	a.branch("next");
+	a.label("do-drop");
+	a.pop(0);
+	a.branch("next");
+	a.label("do-swap");
+	a.pop(0);
+	a.pop(9);
+	a.push(0);
+	a.push(9);
+	a.branch("next");
+	a.label("do-bye");
+	a.pop(0);
+	a.terminate();
+	return a;
+}
+/// copy the input to the output a buffer at a time, the same text the forth workload reads
+Assembler echo() {
+	constexpr Address buffer = 0x20000;
+	constexpr Address chunk = 4096;
+	auto a = start();
+	a.constant(1, buffer);
+	a.constant(5, 0);
+	a.label("loop");
+	a.constant(2, chunk);
+	a.misc(Core::MiscStyle::ReadBuffer, 2, 1);
+	a.compareImmediate(C::Equals, 2, 0);
+	a.branchIf("done");
+	a.arithmetic(A::Add, 5, 2);
+	a.misc(Core::MiscStyle::WriteBuffer, 2, 1);
+	a.branch("loop");
+	a.label("done");
+	a.terminate();
+	return a;
+}
+/**
+ * Read words with ReadWord and the whitespace which ended each of them
+ * with GetCharacter, the delimiter has to be left behind for the second
+ * read just like with >>. Runs until a word comes back empty.
+ */
+Assembler tokens() {
+	constexpr Address buffer = 0x20000;
+	auto a = start();
+	a.constant(1, buffer);
+	a.constant(2, 15);
+	a.constant(5, 0);
+	a.constant(6, 0);
+	a.constant(7, 0);
+	a.label("next");
+	a.misc(Core::MiscStyle::ReadWord, 1, 2);
+	a.copy(AR, 1);
+	a.load(0, 0b0011);
+	a.compareImmediate(C::Equals, VR, 0);
+	a.branchIf("done");
+	a.arithmetic(A::Add, 5, VR);
+	a.misc(Core::MiscStyle::GetCharacter, 3);
+	a.arithmeticImmediate(A::Mul, 6, 3);
+	a.arithmetic(A::Add, 6, 3);
+	a.arithmeticImmediate(A::Add, 7, 1);
+	a.branch("next");
+	a.label("done");
+	a.terminate();
+	return a;
+}
+/**
+ * Fill the disk cache, write it out to block zero, and terminate right
+ * away without waiting for the transfer to finish. Only meaningful with
+ * secondary storage attached, the runner checks the file afterwards.
+ */
+Assembler storage() {
+	namespace memoryMap = cisc0::memoryMap;
+	auto a = start();
+	a.constant(0, 0);
+	a.label("fill");
+	a.constant(AR, memoryMap::ioBase + memoryMap::storageCache);
+	a.arithmetic(A::Add, AR, 0);
+	a.copy(VR, 0);
+	a.arithmeticImmediate(A::Add, VR, 0x1234);
+	a.store(0, 0b0011);
+	a.arithmeticImmediate(A::Add, 0, 1);
+	a.compareImmediate(C::LessThan, 0, cisc0::SecondaryStorage::blockSize);
+	a.branchIf("fill");
+	a.constant(AR, memoryMap::ioBase);
+	a.constant(VR, 0);
+	a.store(memoryMap::storageBlockLower, 0b0011);
+	a.store(memoryMap::storageBlockUpper, 0b0011);
+	a.constant(VR, MemoryWord(cisc0::SecondaryStorage::Command::Write));
+	a.store(memoryMap::storageCommand, 0b0011);
+	a.terminate();
+	return a;
+}
+/// words split up by every kind of whitespace, some of it doubled up
+std::string tokensInput() {
+	std::ostringstream ss;
+	for (int i = 0; i < 5000; ++i) {
+		ss << "alpha beta\ngamma\tdelta  epsilon\n\nzeta" << (i % 7) << ' ';
+	}
+	ss << "omega" << std::endl;
+	return ss.str();
+}
+std::string forthInput() {
+	std::ostringstream ss;
+	ss << "one ";
+	for (int i = 0; i < 20000; ++i) {
+		ss << "one dup add swap one add swap drop dup add one add" << std::endl;
+	}
+	ss << "bye" << std::endl;
+	return ss.str();
+}
+int main(int argc, char** argv) {
+	if (argc != 2) {
+		usage(argv[0]);
+		return 1;
+	}
+	std::string directory = argv[1];
+	const std::pair<const char*, Assembler(*)()> workloads[] = {
+		{ "arithmetic", arithmetic },
+		{ "recursion", recursion },
+		{ "memory", memory },
+		{ "strings", strings },
+		{ "blocks", blocks },
+		{ "forth", forth },
+		{ "echo", echo },
+		{ "tokens", tokens },
+		{ "storage", storage },
+	};
+	try {
+		for (auto& workload : workloads) {
+			auto path = directory + "/" + workload.first + ".obj";
+			std::ofstream out(path.c_str(), std::ios::binary);
+			if (!out.is_open()) {
+				std::cerr << "could not open: " << path << " for writing!" << std::endl;
+				return 1;
+			}
+			workload.second().write(out);
+		}
+		const std::pair<const char*, std::string(*)()> inputs[] = {
+			{ "forth", forthInput },
+			{ "echo", forthInput },
+			{ "tokens", tokensInput },
+		};
+		for (auto& workload : inputs) {
+			auto path = directory + "/" + workload.first + ".in";
+			std::ofstream input(path.c_str(), std::ios::binary);
+			if (!input.is_open()) {
+				std::cerr << "could not open: " << path << " for writing!" << std::endl;
+				return 1;
+			}
+			input << workload.second();
+		}
+	} catch (cisc0::Problem& p) {
+		std::cerr << p.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -1,4 +1,4 @@
-LIBS = -lc -lm
+LIBS = -lc -lm -pthread
 
 CC = cc 
 CXX = c++
@@ -6,6 +6,9 @@ LEX = flex
 YACC = bison
 GENFLAGS = -Wall -Iinclude/ -g3
 CFLAGS = -ansi -std=c99 ${GENFLAGS}
-CXXFLAGS = -std=c++11 ${GENFLAGS}
+# -DCISC0_COUNTERS=1 to count retired instructions by kind and branch outcome,
+# add -DCISC0_COUNTER_TIMING=1 to time each kind as well
+FEATUREFLAGS =
+CXXFLAGS = -std=c++11 ${GENFLAGS} ${FEATUREFLAGS}
 LDFLAGS = ${LIBS}
 PREFIX = /usr/local
@@ -1,7 +1,10 @@
-LIBS = -lc -lm 
+LIBS = -lc -lm -pthread 
 
 CC := gcc
 CXX := g++
 GENFLAGS = -Wall -g3 
-CXXFLAGS = -std=c++17 ${GENFLAGS}
+# -DCISC0_COUNTERS=1 to count retired instructions by kind and branch outcome,
+# add -DCISC0_COUNTER_TIMING=1 to time each kind as well
+FEATUREFLAGS =
+CXXFLAGS = -std=c++17 ${GENFLAGS} ${FEATUREFLAGS}
 LDFLAGS = ${LIBS}